@@ -0,0 +1,92 @@
+#include "allocstats.hh"
+#include <atomic>
+#include <malloc.h>
+#include <new>
+
+namespace {
+struct Counters
+{
+  std::atomic<uint64_t> allocs{0};
+  std::atomic<uint64_t> bytes{0};
+};
+}
+
+// relaxed, we want totals and not ordering
+static Counters g_counters[size_t(AllocPhase::Count)];
+static std::atomic<size_t> g_live{0}, g_peak{0};
+
+void* operator new(size_t n)
+{
+  void* p = malloc(n ? n : 1);
+  if(!p)
+    throw std::bad_alloc();
+  auto& c = g_counters[size_t(t_allocPhase)];
+  c.allocs.fetch_add(1, std::memory_order_relaxed);
+  c.bytes.fetch_add(n, std::memory_order_relaxed);
+  size_t live = g_live.fetch_add(malloc_usable_size(p), std::memory_order_relaxed) + malloc_usable_size(p);
+  for(size_t peak = g_peak.load(std::memory_order_relaxed); live > peak && !g_peak.compare_exchange_weak(peak, live); )
+    ;
+  return p;
+}
+
+void operator delete(void* p) noexcept
+{
+  if(p)
+    g_live.fetch_sub(malloc_usable_size(p), std::memory_order_relaxed);
+  free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+  operator delete(p);
+}
+
+AllocCounts AllocSnapshot::total() const
+{
+  AllocCounts ret;
+  for(const auto& c : phases) {
+    ret.allocs += c.allocs;
+    ret.bytes += c.bytes;
+  }
+  return ret;
+}
+
+AllocSnapshot AllocSnapshot::operator-(const AllocSnapshot& rhs) const
+{
+  AllocSnapshot ret = *this;
+  for(size_t n = 0; n < size_t(AllocPhase::Count); ++n) {
+    ret.phases[n].allocs -= rhs.phases[n].allocs;
+    ret.phases[n].bytes -= rhs.phases[n].bytes;
+  }
+  return ret;
+}
+
+AllocSnapshot allocSnapshot()
+{
+  AllocSnapshot ret;
+  for(size_t n = 0; n < size_t(AllocPhase::Count); ++n) {
+    ret.phases[n].allocs = g_counters[n].allocs;
+    ret.phases[n].bytes = g_counters[n].bytes;
+  }
+  ret.live = g_live;
+  ret.peak = g_peak;
+  return ret;
+}
+
+void resetAllocPeak()
+{
+  g_peak = g_live.load();
+}
+
+const char* allocPhaseName(AllocPhase p)
+{
+  switch(p) {
+  case AllocPhase::Other: return "other";
+  case AllocPhase::GrammarLoad: return "grammar_load";
+  case AllocPhase::Parse: return "parse";
+  case AllocPhase::Actions: return "actions";
+  case AllocPhase::ResultBuild: return "result_build";
+  case AllocPhase::Count: break;
+  }
+  return "unknown";
+}
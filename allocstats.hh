@@ -0,0 +1,47 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+/* Heap allocation accounting. Code marks what it is doing with an
+   AllocPhaseScope, which costs a thread local store. Counting only happens in
+   programs that link allocstats.o, which replaces the global operator new and
+   delete, so it is opt-in per binary */
+
+enum class AllocPhase : uint8_t { Other, GrammarLoad, Parse, Actions, ResultBuild, Count };
+
+inline thread_local AllocPhase t_allocPhase = AllocPhase::Other;
+
+// allocations of this thread are charged to 'phase' until the scope ends
+class AllocPhaseScope
+{
+public:
+  explicit AllocPhaseScope(AllocPhase phase) : d_prev(t_allocPhase) { t_allocPhase = phase; }
+  ~AllocPhaseScope() { t_allocPhase = d_prev; }
+  AllocPhaseScope(const AllocPhaseScope&) = delete;
+  AllocPhaseScope& operator=(const AllocPhaseScope&) = delete;
+
+private:
+  AllocPhase d_prev;
+};
+
+struct AllocCounts
+{
+  uint64_t allocs = 0;
+  uint64_t bytes = 0; // requested, not what malloc rounded up to
+};
+
+// totals since program start, subtract two to measure something
+struct AllocSnapshot
+{
+  AllocCounts phases[size_t(AllocPhase::Count)];
+  size_t live = 0; // usable bytes currently allocated
+  size_t peak = 0; // highest 'live' since resetAllocPeak()
+
+  const AllocCounts& operator[](AllocPhase p) const { return phases[size_t(p)]; }
+  AllocCounts total() const;
+  AllocSnapshot operator-(const AllocSnapshot& rhs) const; // live and peak are taken from *this
+};
+
+AllocSnapshot allocSnapshot();
+void resetAllocPeak();
+const char* allocPhaseName(AllocPhase p);
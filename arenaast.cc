@@ -0,0 +1,114 @@
+#include "arenaast.hh"
+#include "peglib.h"
+#include <algorithm>
+#include <cstring>
+using namespace std;
+
+void ArenaAst::attach(peg::parser& p)
+{
+  for(const auto& g : p.get_grammar()) {
+    auto& rule = p[g.first.c_str()];
+    if(rule.action)
+      continue;
+    auto r = &rule;
+    auto tag = peg::str2tag(rule.name);
+    rule.action = [this, r, tag](const peg::SemanticValues& vs) {
+      Node n;
+      n.name = n.originalName = r->name.c_str();
+      n.position = std::distance(vs.ss, vs.sv().data());
+      n.length = vs.sv().length();
+      n.choice = n.originalChoice = vs.choice();
+      n.choiceCount = n.originalChoiceCount = vs.choice_count();
+      n.tag = tag;
+      n.isToken = r->is_token();
+      if(n.isToken)
+        n.token = vs.token();
+      else {
+        n.firstChild = d_children.size();
+        for(const auto& v : vs)
+          if(auto c = std::any_cast<uint32_t>(&v))
+            d_children.push_back(*c);
+        n.childCount = d_children.size() - n.firstChild;
+      }
+      uint32_t idx = d_nodes.size();
+      d_nodes.push_back(n);
+      for(uint32_t pos = n.firstChild; pos < n.firstChild + n.childCount; ++pos)
+        d_nodes[d_children[pos]].parent = idx;
+      return idx;
+    };
+  }
+}
+
+bool ArenaAst::parse(const peg::parser& p, std::string_view in, const char* path)
+{
+  d_nodes.clear();
+  d_children.clear();
+  d_root = npos;
+  d_input = in;
+  uint32_t root = npos;
+  if(!p.parse(in, root, path))
+    return false;
+  d_root = root;
+  return true;
+}
+
+// mirrors AstOptimizer::optimize, but rewrites child slots instead of copying the tree
+uint32_t ArenaAst::collapse(uint32_t idx, uint32_t parent, const std::vector<std::string>& rules, bool mode)
+{
+  auto& n = d_nodes[idx];
+  bool found = std::find(rules.begin(), rules.end(), n.name) != rules.end();
+  bool opt = mode ? !found : found;
+
+  if(opt && n.childCount == 1) {
+    uint32_t c = collapse(d_children[n.firstChild], parent, rules, mode);
+    auto& cn = d_nodes[c];
+    cn.originalName = n.name;
+    cn.originalChoice = n.choice;
+    cn.originalChoiceCount = n.choiceCount;
+    cn.parent = parent;
+    return c;
+  }
+  n.parent = parent;
+  for(uint32_t pos = n.firstChild; pos < n.firstChild + n.childCount; ++pos)
+    d_children[pos] = collapse(d_children[pos], idx, rules, mode);
+  return idx;
+}
+
+void ArenaAst::optimize(const std::vector<std::string>& noOptRules, bool mode)
+{
+  if(d_root != npos)
+    d_root = collapse(d_root, npos, noOptRules, mode);
+}
+
+std::pair<size_t, size_t> ArenaAst::lineInfo(uint32_t idx) const
+{
+  return peg::line_info(d_input.data(), d_input.data() + d_nodes[idx].position);
+}
+
+void ArenaAst::toString(uint32_t idx, std::string& s, int level) const
+{
+  const auto& n = d_nodes[idx];
+  s.append(2 * level, ' ');
+  string name = n.originalName;
+  if(n.originalChoiceCount > 0)
+    name += "/" + std::to_string(n.originalChoice);
+  if(strcmp(n.name, n.originalName))
+    name += "[" + string(n.name) + "]";
+  if(n.isToken) {
+    s += "- " + name + " (";
+    s += n.token;
+    s += ")\n";
+  }
+  else
+    s += "+ " + name + "\n";
+  for(auto c : children(idx))
+    toString(c, s, level + 1);
+}
+
+std::string ArenaAst::toString() const
+{
+  string s;
+  if(d_root != npos)
+    toString(d_root, s, 0);
+  return s;
+}
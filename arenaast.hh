@@ -0,0 +1,105 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace peg {
+  struct parser;
+}
+
+/* An alternative to peg::parser::enable_ast() that does not make_shared every
+   node. All nodes of a parse live in one vector that is reused across parses,
+   children are 32-bit indices into a second vector, and tokens are
+   string_views into the input. The input must therefore outlive the tree.
+
+   Nodes created by alternatives that later backtrack stay in the arena
+   unreferenced, they are only reclaimed by the next parse. */
+
+class ArenaAst
+{
+public:
+  static constexpr uint32_t npos = UINT32_MAX;
+
+  struct Node
+  {
+    const char* name;          // rule name, owned by the grammar
+    const char* originalName;  // differs from name after optimize()
+    std::string_view token;    // only meaningful if isToken
+    size_t position;
+    size_t length;
+    uint32_t firstChild = 0;   // index into the child index table
+    uint32_t childCount = 0;
+    uint32_t parent = npos;
+    uint32_t choice;
+    uint32_t choiceCount;
+    uint32_t originalChoice;
+    uint32_t originalChoiceCount;
+    unsigned int tag;          // peg::str2tag(name)
+    bool isToken;
+  };
+
+  struct ChildRange
+  {
+    const uint32_t* b;
+    const uint32_t* e;
+    const uint32_t* begin() const { return b; }
+    const uint32_t* end() const { return e; }
+    size_t size() const { return e - b; }
+    uint32_t operator[](size_t n) const { return b[n]; }
+  };
+
+  // installs node building actions on all rules that do not have one yet
+  void attach(peg::parser& p);
+  // clears the arena (keeping capacity) and parses, root() is valid on success
+  bool parse(const peg::parser& p, std::string_view in, const char* path=nullptr);
+
+  // collapses single-child nodes in place, like peg::AstOptimizer
+  void optimize(const std::vector<std::string>& noOptRules = {}, bool mode = true);
+
+  uint32_t root() const { return d_root; }
+  const Node& operator[](uint32_t idx) const { return d_nodes[idx]; }
+  ChildRange children(uint32_t idx) const
+  {
+    const auto& n = d_nodes[idx];
+    const uint32_t* b = d_children.data() + n.firstChild;
+    return {b, b + n.childCount};
+  }
+  size_t size() const { return d_nodes.size(); }
+  size_t memoryUsage() const
+  {
+    return d_nodes.capacity() * sizeof(Node) + d_children.capacity() * sizeof(uint32_t);
+  }
+
+  // computed on demand, the arena does not store line numbers per node
+  std::pair<size_t, size_t> lineInfo(uint32_t idx) const;
+
+  // calls f(idx, depth) in pre-order, return false from f to skip the children
+  template<typename F>
+  void visit(F&& f) const
+  {
+    if(d_root != npos)
+      visit(d_root, 0, f);
+  }
+
+  // same format as peg::ast_to_s()
+  std::string toString() const;
+
+private:
+  template<typename F>
+  void visit(uint32_t idx, int depth, F& f) const
+  {
+    if(!f(idx, depth))
+      return;
+    for(auto c : children(idx))
+      visit(c, depth + 1, f);
+  }
+  void toString(uint32_t idx, std::string& s, int level) const;
+  uint32_t collapse(uint32_t idx, uint32_t parent, const std::vector<std::string>& rules, bool mode);
+
+  std::vector<Node> d_nodes;
+  std::vector<uint32_t> d_children;
+  uint32_t d_root = npos;
+  std::string_view d_input;
+};
@@ -0,0 +1,106 @@
+#include "arenaast.hh"
+#include "peglib.h"
+#include <fmt/core.h>
+#include <chrono>
+#include <malloc.h>
+using namespace std;
+
+// compares the shared_ptr AST from enable_ast() with ArenaAst
+// run as ./astbench [items]
+
+static size_t g_live, g_peak, g_allocs;
+
+void* operator new(size_t n)
+{
+  void* p = malloc(n);
+  if(!p)
+    throw std::bad_alloc();
+  g_live += malloc_usable_size(p);
+  g_peak = std::max(g_peak, g_live);
+  g_allocs++;
+  return p;
+}
+
+void operator delete(void* p) noexcept
+{
+  if(p)
+    g_live -= malloc_usable_size(p);
+  free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+  operator delete(p);
+}
+
+static const char* grammar = R"(
+List    <- Item (',' Item)*
+Item    <- Pair / Number
+Pair    <- '(' Number ',' Number ')'
+Number  <- < [0-9]+ ('.' [0-9]+)? >
+%whitespace <- [ \n]*
+)";
+
+struct Measurement
+{
+  double msec;
+  size_t allocs;
+  size_t peak;
+  size_t items;
+};
+
+template<typename F>
+static Measurement measure(F f)
+{
+  size_t base = g_live;
+  g_peak = g_live;
+  size_t allocs = g_allocs;
+  auto start = chrono::steady_clock::now();
+  size_t items = f();
+  auto stop = chrono::steady_clock::now();
+  return {chrono::duration<double, milli>(stop - start).count(),
+          g_allocs - allocs, g_peak - base, items};
+}
+
+static void report(const char* name, const Measurement& m)
+{
+  fmt::print("{:<12} {:10.2f} ms {:10} allocs {:10.1f} MB peak {:10} items\n",
+             name, m.msec, m.allocs, m.peak / 1048576.0, m.items);
+}
+
+int main(int argc, char** argv)
+{
+  size_t items = argc > 1 ? atoi(argv[1]) : 200000;
+  string in;
+  for(size_t n = 0; n < items; ++n) {
+    if(n)
+      in += n % 8 ? ", " : ",\n";
+    if(n % 3)
+      in += to_string(n);
+    else
+      in += fmt::format("({}.5, {})", n, n * 7);
+  }
+  fmt::print("input: {} items, {} bytes\n", items, in.size());
+
+  peg::parser ref(grammar);
+  ref.enable_ast();
+  report("shared_ptr", measure([&]() -> size_t {
+    shared_ptr<peg::Ast> ast;
+    if(!ref.parse(in, ast))
+      throw runtime_error("parse failed");
+    ast = ref.optimize_ast(ast);
+    return ast->nodes.size();
+  }));
+
+  peg::parser p(grammar);
+  ArenaAst ast;
+  ast.attach(p);
+  for(int run = 0; run < 2; ++run) { // second run shows the reused arena
+    report(run ? "arena reuse" : "arena", measure([&]() -> size_t {
+      if(!ast.parse(p, in))
+        throw runtime_error("parse failed");
+      ast.optimize();
+      return ast.children(ast.root()).size();
+    }));
+  }
+}
@@ -0,0 +1,64 @@
+#include "scrapediff.hh"
+#include <fmt/core.h>
+#include <chrono>
+using namespace std;
+
+// rates between two synthetic scrapes, nested map lookups against a merge
+// of fingerprint sorted counters
+// run as ./diffbench [series]
+
+template<typename F>
+static double msec(F f)
+{
+  auto start = chrono::steady_clock::now();
+  f();
+  return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char** argv)
+{
+  size_t nseries = argc > 1 ? atoi(argv[1]) : 1000000;
+  PromParser::promparseres_t prev, cur;
+  for(size_t n = 0; n < nseries; ++n) {
+    string name = fmt::format("requests_{}_total", n % 1000);
+    map<string, string> labels{{"instance", fmt::format("host{}:9100", n / 1000)}, {"job", "node"}};
+    prev[name].type = cur[name].type = "counter";
+    prev[name].vals[labels] = {0, double(n)};
+    if(n % 100) // some series vanish
+      cur[name].vals[labels] = {0, n % 50 ? double(n + 15) : 1.0};
+  }
+  fmt::print("{} series\n", nseries);
+
+  double sum = 0;
+  size_t rows = 0;
+  double t = msec([&]() {
+    for(const auto& [name, entry] : cur) {
+      auto piter = prev.find(name);
+      if(piter == prev.end())
+        continue;
+      for(const auto& [labels, tv] : entry.vals) {
+        auto viter = piter->second.vals.find(labels);
+        if(viter == piter->second.vals.end())
+          continue;
+        double delta = tv.value < viter->second.value ? tv.value : tv.value - viter->second.value;
+        sum += delta / 15;
+        rows++;
+      }
+    }
+  });
+  fmt::print("{:<24} {:10.1f} ms ({} rows, sum {})\n", "nested map lookups", t, rows, sum);
+
+  CounterScrape prevScrape(prev, 1713712554000);
+  double prep = msec([&]() {
+    CounterScrape curScrape(cur, 1713712569000);
+    double t = msec([&]() {
+      auto d = diffCounters(prevScrape, curScrape);
+      sum = 0;
+      for(auto r : d.rates)
+        sum += r;
+      rows = d.rows.size();
+    });
+    fmt::print("{:<24} {:10.1f} ms ({} rows, sum {})\n", "fingerprint merge", t, rows, sum);
+  });
+  fmt::print("{:<24} {:10.1f} ms, once per scrape\n", "fingerprint and sort", prep);
+}
@@ -0,0 +1,115 @@
+#include "expogen.hh"
+#include <fmt/core.h>
+#include <random>
+#include <stdexcept>
+using namespace std;
+
+namespace {
+// no std::uniform_*_distribution, their output differs between standard libraries
+struct Rng
+{
+  explicit Rng(uint64_t seed) : d_gen(seed) {}
+  uint64_t below(uint64_t n) { return d_gen() % n; }
+  bool chance(double p) { return (d_gen() >> 11) * 0x1.0p-53 < p; }
+  mt19937_64 d_gen;
+};
+}
+
+static void appendLabelValue(string& out, Rng& rng, const ExpoGenOptions& opts)
+{
+  static const char alphabet[] = "abcdefghijklmnopqrstuvwxyz0123456789-._:/ ";
+  for(unsigned int n = 0; n < opts.labelLength; ++n) {
+    if(rng.chance(opts.escapes)) {
+      static const char* escaped[] = {"\\\\", "\\\"", "\\n"};
+      out += escaped[rng.below(3)];
+    }
+    else
+      out += alphabet[rng.below(sizeof(alphabet) - 1)];
+  }
+}
+
+static void appendValue(string& out, Rng& rng, const ExpoGenOptions& opts, bool counter)
+{
+  if(rng.chance(opts.special)) {
+    static const char* special[] = {"NaN", "+Inf", "-Inf"};
+    out += special[rng.below(3)];
+  }
+  else if(rng.chance(opts.exponents))
+    out += fmt::format("{}.{}e{}{:02}", 1 + rng.below(9), rng.below(1000), rng.below(2) ? '+' : '-', rng.below(30));
+  else if(counter)
+    out += to_string(rng.below(1ULL << 40));
+  else
+    out += fmt::format("{}.{}", rng.below(100000), rng.below(1000));
+}
+
+std::string generateExposition(const ExpoGenOptions& opts)
+{
+  Rng rng(opts.seed);
+  string out;
+  int64_t tstamp = 1713712554000;
+  for(unsigned int f = 0; f < opts.families; ++f) {
+    bool counter = f % 2 == 0;
+    string name = fmt::format("synthetic_metric_{}{}", f, counter ? "_total" : "");
+    out += fmt::format("# HELP {} Synthetic family number {}.\n# TYPE {} {}\n", name, f, name, counter ? "counter" : "gauge");
+    for(unsigned int s = 0; s < opts.series; ++s) {
+      out += name;
+      if(opts.labels) {
+        out += '{';
+        for(unsigned int l = 0; l < opts.labels; ++l) {
+          out += fmt::format("{}label{}=\"", l ? "," : "", l);
+          appendLabelValue(out, rng, opts);
+          out += '"';
+        }
+        out += '}';
+      }
+      out += ' ';
+      appendValue(out, rng, opts, counter);
+      if(rng.chance(opts.timestamps))
+        out += fmt::format(" {}", tstamp + int64_t(rng.below(15000)));
+      out += '\n';
+    }
+  }
+  return out;
+}
+
+bool parseExpoGenOption(std::string_view arg, ExpoGenOptions& opts)
+{
+  auto eq = arg.find('=');
+  if(arg.substr(0, 2) != "--" || eq == string_view::npos)
+    return false;
+  auto name = arg.substr(2, eq - 2);
+  string value(arg.substr(eq + 1));
+  try {
+    if(name == "seed") opts.seed = stoull(value);
+    else if(name == "families") opts.families = stoul(value);
+    else if(name == "series") opts.series = stoul(value);
+    else if(name == "labels") opts.labels = stoul(value);
+    else if(name == "label-length") opts.labelLength = stoul(value);
+    else if(name == "escapes") opts.escapes = stod(value);
+    else if(name == "special") opts.special = stod(value);
+    else if(name == "exponents") opts.exponents = stod(value);
+    else if(name == "timestamps") opts.timestamps = stod(value);
+    else
+      return false;
+  }
+  catch(std::logic_error&) {
+    throw runtime_error(fmt::format("Invalid value in '{}'", arg));
+  }
+  return true;
+}
+
+std::string expoGenUsage()
+{
+  ExpoGenOptions d;
+  return fmt::format(
+    "  --seed=N          random seed ({})\n"
+    "  --families=N      metric families ({})\n"
+    "  --series=N        series per family ({})\n"
+    "  --labels=N        labels per series ({})\n"
+    "  --label-length=N  characters per label value ({})\n"
+    "  --escapes=F       fraction of escaped label value characters ({})\n"
+    "  --special=F       fraction of NaN and Inf values ({})\n"
+    "  --exponents=F     fraction of values with an exponent ({})\n"
+    "  --timestamps=F    fraction of samples with a timestamp ({})\n",
+    d.seed, d.families, d.series, d.labels, d.labelLength, d.escapes, d.special, d.exponents, d.timestamps);
+}
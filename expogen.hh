@@ -0,0 +1,26 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// shape of a synthetic exposition, fractions are per sample or per character
+struct ExpoGenOptions
+{
+  uint64_t seed = 1;
+  unsigned int families = 100;
+  unsigned int series = 20;        // per family
+  unsigned int labels = 3;         // per series
+  unsigned int labelLength = 12;   // characters per label value
+  double escapes = 0.01;           // label value characters that are escaped
+  double special = 0.01;           // values that are NaN, +Inf or -Inf
+  double exponents = 0.1;          // values written as 1.5e+06
+  double timestamps = 0.5;         // samples with a timestamp
+};
+
+// the same options and seed always produce the same text, on any platform
+std::string generateExposition(const ExpoGenOptions& opts);
+
+// parses --name=value for the fields above, false if arg is not one of them
+bool parseExpoGenOption(std::string_view arg, ExpoGenOptions& opts);
+// one line per option, for usage messages
+std::string expoGenUsage();
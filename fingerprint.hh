@@ -0,0 +1,27 @@
+#pragma once
+#include <cstdint>
+#include <map>
+#include <string>
+#include <string_view>
+
+// 64 bit FNV-1a over the name and the sorted labels, the key by which series
+// are recognised across scrapes. Different series can collide, so compare the
+// labels too before treating two series as the same
+inline uint64_t seriesFingerprint(std::string_view name, const std::map<std::string, std::string>& labels)
+{
+  uint64_t h = 14695981039346656037ULL;
+  auto add = [&h](std::string_view s) {
+    for(unsigned char c : s) {
+      h ^= c;
+      h *= 1099511628211ULL;
+    }
+    h ^= 0xff; // separator, no valid UTF-8 contains it
+    h *= 1099511628211ULL;
+  };
+  add(name);
+  for(const auto& [k, v] : labels) {
+    add(k);
+    add(v);
+  }
+  return h;
+}
@@ -0,0 +1,154 @@
+#include "histograms.hh"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+using namespace std;
+
+static const double s_nan = std::numeric_limits<double>::quiet_NaN();
+
+// the whole of 'in' has to be a number, strtod also takes +Inf
+static bool parseBound(const string& in, double& out)
+{
+  if(in.empty())
+    return false;
+  char* end;
+  out = strtod(in.c_str(), &end);
+  return *end == 0 && !std::isnan(out);
+}
+
+namespace {
+// collects the parts of one family before they are packed into HistogramFamily
+struct Builder
+{
+  struct Parts
+  {
+    vector<pair<double, double>> points; // bound, value
+    double sum = s_nan;
+    double count = s_nan;
+    int64_t tstampmsec = 0;
+  };
+  map<map<string, string>, Parts> series;
+};
+}
+
+static void addPoints(Builder& b, const PromParser::PromEntry& entry, const char* label)
+{
+  for(const auto& [labels, tv] : entry.vals) {
+    auto iter = labels.find(label);
+    double bound;
+    if(iter == labels.end() || !parseBound(iter->second, bound))
+      continue;
+    auto rest = labels;
+    rest.erase(iter->first);
+    auto& parts = b.series[std::move(rest)];
+    parts.points.push_back({bound, tv.value});
+    parts.tstampmsec = max(parts.tstampmsec, tv.tstampmsec);
+  }
+}
+
+static void addScalar(Builder& b, const PromParser::PromEntry& entry, double Builder::Parts::*field)
+{
+  for(const auto& [labels, tv] : entry.vals) {
+    auto& parts = b.series[labels];
+    parts.*field = tv.value;
+    parts.tstampmsec = max(parts.tstampmsec, tv.tstampmsec);
+  }
+}
+
+static HistogramFamily pack(HistogramFamily::Kind kind, const string& help, Builder& b)
+{
+  HistogramFamily ret;
+  ret.kind = kind;
+  ret.help = help;
+  ret.series.reserve(b.series.size());
+  for(auto& [labels, parts] : b.series) {
+    HistogramFamily::Series s;
+    s.labels = labels;
+    s.first = ret.bounds.size();
+    s.sum = parts.sum;
+    s.count = parts.count;
+    s.tstampmsec = parts.tstampmsec;
+
+    sort(parts.points.begin(), parts.points.end());
+    for(const auto& [bound, value] : parts.points) {
+      if(ret.bounds.size() > s.first && ret.bounds.back() == bound) {
+        // 'le="1"' and 'le="1.0"', which came out as two series
+        ret.values.back() += value;
+        continue;
+      }
+      ret.bounds.push_back(bound);
+      ret.values.push_back(value);
+    }
+    s.size = ret.bounds.size() - s.first;
+    // scrapes are not atomic, so a bucket can lag behind a lower one
+    if(kind == HistogramFamily::Kind::Histogram)
+      for(uint32_t n = s.first + 1; n < s.first + s.size; ++n)
+        ret.values[n] = max(ret.values[n], ret.values[n - 1]);
+    ret.series.push_back(std::move(s));
+  }
+  return ret;
+}
+
+histograms_t assembleHistograms(const PromParser::promparseres_t& res)
+{
+  histograms_t ret;
+  for(const auto& [name, entry] : res) {
+    HistogramFamily::Kind kind;
+    if(entry.type == "histogram")
+      kind = HistogramFamily::Kind::Histogram;
+    else if(entry.type == "summary")
+      kind = HistogramFamily::Kind::Summary;
+    else
+      continue;
+
+    Builder b;
+    if(kind == HistogramFamily::Kind::Summary)
+      addPoints(b, entry, "quantile");
+    else if(auto iter = res.find(name + "_bucket"); iter != res.end())
+      addPoints(b, iter->second, "le");
+    if(auto iter = res.find(name + "_sum"); iter != res.end())
+      addScalar(b, iter->second, &Builder::Parts::sum);
+    if(auto iter = res.find(name + "_count"); iter != res.end())
+      addScalar(b, iter->second, &Builder::Parts::count);
+    ret.emplace(name, pack(kind, entry.help, b));
+  }
+  return ret;
+}
+
+double histogramQuantile(double q, const double* bounds, const double* counts, size_t n)
+{
+  if(std::isnan(q))
+    return s_nan;
+  if(q < 0)
+    return -std::numeric_limits<double>::infinity();
+  if(q > 1)
+    return std::numeric_limits<double>::infinity();
+  if(n < 2 || !std::isinf(bounds[n - 1]) || bounds[n - 1] < 0)
+    return s_nan;
+  double observations = counts[n - 1];
+  if(!(observations > 0))
+    return s_nan;
+
+  double rank = q * observations;
+  size_t b = std::lower_bound(counts, counts + n - 1, rank) - counts;
+  if(b == n - 1) // in the +Inf bucket, the best guess is the highest finite bound
+    return bounds[n - 2];
+  if(b == 0 && bounds[0] <= 0)
+    return bounds[0];
+
+  double start = 0, end = bounds[b], count = counts[b];
+  if(b > 0) {
+    start = bounds[b - 1];
+    count -= counts[b - 1];
+    rank -= counts[b - 1];
+  }
+  return start + (end - start) * (rank / count);
+}
+
+double HistogramFamily::quantile(double q, const Series& s) const
+{
+  if(kind != Kind::Histogram)
+    return s_nan;
+  return histogramQuantile(q, boundsOf(s), valuesOf(s), s.size);
+}
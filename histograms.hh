@@ -0,0 +1,53 @@
+#pragma once
+#include "promparser.hh"
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+/* Histogram and summary families, put back together from the separate series
+   the text format spreads them over: name_bucket{le=...}, name_sum and
+   name_count for a histogram, name{quantile=...}, name_sum and name_count for
+   a summary. Which names belong together follows from '# TYPE'.
+
+   The bounds and values of all series of a family are in two contiguous
+   arrays, each series has a slice of both sorted by bound. So nothing has to
+   look at 'le' or 'quantile' strings after assembly. */
+struct HistogramFamily
+{
+  enum class Kind { Histogram, Summary };
+  Kind kind;
+  std::string help;
+
+  struct Series
+  {
+    std::map<std::string, std::string> labels; // without le or quantile
+    uint32_t first = 0;  // slice of bounds and values
+    uint32_t size = 0;
+    double sum;          // NaN if there was no _sum, same for _count
+    double count;
+    int64_t tstampmsec = 0;
+  };
+  std::vector<Series> series;
+  // histograms: upper bounds with +Inf last, and cumulative counts that are
+  // forced to be monotonic. summaries: quantiles and their values
+  std::vector<double> bounds;
+  std::vector<double> values;
+
+  const double* boundsOf(const Series& s) const { return bounds.data() + s.first; }
+  const double* valuesOf(const Series& s) const { return values.data() + s.first; }
+  // histogram_quantile() of PromQL for one histogram series, NaN for summaries
+  // which come with their quantiles already computed
+  double quantile(double q, const Series& s) const;
+};
+
+typedef std::map<std::string, HistogramFamily> histograms_t;
+
+// keyed by family name. Samples with an le or quantile that is not a number
+// are left out, buckets with the same bound are added up
+histograms_t assembleHistograms(const PromParser::promparseres_t& res);
+
+// estimates quantile q like PromQL histogram_quantile() does, by linear
+// interpolation within the bucket that holds it. bounds ascend and end with
+// +Inf, counts are cumulative and monotonic. O(log n), does not allocate
+double histogramQuantile(double q, const double* bounds, const double* counts, size_t n);
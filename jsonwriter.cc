@@ -0,0 +1,156 @@
+#include "jsonwriter.hh"
+#include "nlohmann_dtoa.h"
+#include <cerrno>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <unistd.h>
+using namespace std;
+
+BufferedWriter::BufferedWriter(int fd, size_t bufsize) : d_fd(fd), d_bufsize(bufsize)
+{
+  d_buf.reserve(bufsize);
+}
+
+BufferedWriter::~BufferedWriter()
+{
+  try {
+    flush();
+  }
+  catch(...) {}
+}
+
+void BufferedWriter::flush()
+{
+  const char* p = d_buf.data();
+  size_t left = d_buf.size();
+  while(left) {
+    auto res = write(d_fd, p, left);
+    if(res < 0) {
+      if(errno == EINTR)
+        continue;
+      d_buf.clear();
+      throw runtime_error(string("Writing output: ") + strerror(errno));
+    }
+    p += res;
+    left -= res;
+  }
+  d_buf.clear();
+}
+
+void appendJsonEscaped(std::string& out, std::string_view str)
+{
+  static const char hex[] = "0123456789abcdef";
+  for(unsigned char c : str) {
+    switch(c) {
+    case '"': out += "\\\""; break;
+    case '\\': out += "\\\\"; break;
+    case '\b': out += "\\b"; break;
+    case '\f': out += "\\f"; break;
+    case '\n': out += "\\n"; break;
+    case '\r': out += "\\r"; break;
+    case '\t': out += "\\t"; break;
+    default:
+      if(c < 0x20) {
+        out += "\\u00";
+        out += hex[c >> 4];
+        out += hex[c & 0xf];
+      }
+      else
+        out += (char)c;
+    }
+  }
+}
+
+// nlohmann's own Grisu2, as the shortest round-trip digits differ from it for
+// about 0.2% of doubles
+void appendJsonDouble(std::string& out, double d)
+{
+  if(!std::isfinite(d)) {
+    out += "null";
+    return;
+  }
+  char buf[64];
+  out.append(buf, nlohmann_dtoa::to_chars(buf, buf + sizeof(buf), d));
+}
+
+void JsonWriter::newline(size_t level)
+{
+  if(d_indent < 0)
+    return;
+  d_out.append('\n');
+  for(size_t n = 0; n < level * d_indent; ++n)
+    d_out.append(' ');
+}
+
+void JsonWriter::element()
+{
+  if(d_afterKey) {
+    d_afterKey = false;
+    return;
+  }
+  if(d_empty.empty())
+    return;
+  if(!d_empty.back())
+    d_out.append(',');
+  d_empty.back() = false;
+  newline(d_empty.size());
+}
+
+void JsonWriter::open(char c)
+{
+  element();
+  d_out.append(c);
+  d_empty.push_back(true);
+}
+
+void JsonWriter::close(char c)
+{
+  bool empty = d_empty.back();
+  d_empty.pop_back();
+  if(!empty)
+    newline(d_empty.size());
+  d_out.append(c);
+}
+
+void JsonWriter::key(std::string_view k)
+{
+  element();
+  d_scratch = "\"";
+  appendJsonEscaped(d_scratch, k);
+  d_scratch += d_indent < 0 ? "\":" : "\": ";
+  d_out.append(d_scratch);
+  d_afterKey = true;
+}
+
+void JsonWriter::value(std::string_view str)
+{
+  element();
+  d_scratch = "\"";
+  appendJsonEscaped(d_scratch, str);
+  d_scratch += '"';
+  d_out.append(d_scratch);
+}
+
+void JsonWriter::value(double d)
+{
+  element();
+  d_scratch.clear();
+  appendJsonDouble(d_scratch, d);
+  d_out.append(d_scratch);
+}
+
+void JsonWriter::value(int64_t i)
+{
+  element();
+  char buf[24];
+  auto res = std::to_chars(buf, buf + sizeof(buf), i);
+  d_out.append(string_view(buf, res.ptr - buf));
+}
+
+void JsonWriter::null()
+{
+  element();
+  d_out.append("null");
+}
@@ -0,0 +1,72 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// collects output in a fixed size buffer and hands it to write(2) in big chunks
+class BufferedWriter
+{
+public:
+  explicit BufferedWriter(int fd, size_t bufsize = 1 << 16);
+  ~BufferedWriter(); // flushes, but cannot report errors, so call flush() yourself
+  BufferedWriter(const BufferedWriter&) = delete;
+  BufferedWriter& operator=(const BufferedWriter&) = delete;
+
+  void append(std::string_view s)
+  {
+    if(d_buf.size() + s.size() > d_bufsize)
+      flush();
+    d_buf.append(s);
+  }
+  void append(char c)
+  {
+    if(d_buf.size() + 1 > d_bufsize)
+      flush();
+    d_buf.push_back(c);
+  }
+  void flush();
+
+private:
+  int d_fd;
+  size_t d_bufsize;
+  std::string d_buf;
+};
+
+// JSON string contents with the same escaping as nlohmann::json::dump(), without the quotes
+void appendJsonEscaped(std::string& out, std::string_view str);
+// round-trip representation from the same Grisu2 code as nlohmann::json::dump(), NaN and Inf become null
+void appendJsonDouble(std::string& out, double d);
+
+/* Emits JSON as it is produced, byte-identical to nlohmann::json::dump(indent).
+   Memory use only depends on the nesting depth. Keys are written in the order
+   given, so pass them sorted if the output has to match a std::map based DOM. */
+class JsonWriter
+{
+public:
+  explicit JsonWriter(BufferedWriter& out, int indent = -1) : d_out(out), d_indent(indent) {}
+
+  void startObject() { open('{'); }
+  void endObject() { close('}'); }
+  void startArray() { open('['); }
+  void endArray() { close(']'); }
+
+  void key(std::string_view k);
+  void value(std::string_view str);
+  void value(const char* str) { value(std::string_view(str)); }
+  void value(double d);
+  void value(int64_t i);
+  void null();
+
+private:
+  void open(char c);
+  void close(char c);
+  void element(); // separator and indentation before an array element or key
+  void newline(size_t level);
+
+  BufferedWriter& d_out;
+  int d_indent;
+  std::vector<bool> d_empty; // per open object/array, nothing written yet
+  bool d_afterKey = false;
+  std::string d_scratch;
+};
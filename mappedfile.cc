@@ -0,0 +1,76 @@
+#include "mappedfile.hh"
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+using namespace std;
+
+static void readAll(int fd, string& out)
+{
+  char buf[65536];
+  for(;;) {
+    auto res = read(fd, buf, sizeof(buf));
+    if(res < 0) {
+      if(errno == EINTR)
+        continue;
+      throw runtime_error(string("Reading input: ") + strerror(errno));
+    }
+    if(!res)
+      break;
+    out.append(buf, res);
+  }
+}
+
+MappedFile::MappedFile(const std::string& fname)
+{
+  if(fname == "-") {
+    readAll(0, d_buffer);
+    d_view = d_buffer;
+    return;
+  }
+
+  int fd = open(fname.c_str(), O_RDONLY | O_CLOEXEC);
+  if(fd < 0)
+    throw runtime_error("Unable to open '"+fname+"': "+strerror(errno));
+
+  struct stat st;
+  if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(p != MAP_FAILED) {
+      madvise(p, st.st_size, MADV_SEQUENTIAL);
+      d_map = p;
+      d_maplen = st.st_size;
+      d_view = string_view((const char*)p, d_maplen);
+      close(fd);
+      return;
+    }
+  }
+  // not a regular file (pipe, /dev/stdin, proc file) or mmap refused
+  try {
+    readAll(fd, d_buffer);
+  }
+  catch(...) {
+    close(fd);
+    throw;
+  }
+  close(fd);
+  d_view = d_buffer;
+}
+
+MappedFile::MappedFile(MappedFile&& rhs) noexcept
+  : d_map(rhs.d_map), d_maplen(rhs.d_maplen), d_buffer(std::move(rhs.d_buffer))
+{
+  d_view = d_map ? rhs.d_view : string_view(d_buffer);
+  rhs.d_map = nullptr;
+  rhs.d_maplen = 0;
+  rhs.d_view = string_view();
+}
+
+MappedFile::~MappedFile()
+{
+  if(d_map)
+    munmap(d_map, d_maplen);
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include <string>
+#include <string_view>
+
+/* Read-only view of a file's contents. Regular files are mmap()ed with
+   MADV_SEQUENTIAL so the parser reads straight from the page cache, without
+   copying. Pipes, stdin ("-") and anything else that cannot be mapped are read
+   into a string instead. */
+
+class MappedFile
+{
+public:
+  explicit MappedFile(const std::string& fname);
+  MappedFile(MappedFile&& rhs) noexcept;
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+  ~MappedFile();
+
+  std::string_view view() const { return d_view; }
+  bool isMapped() const { return d_map != nullptr; }
+
+private:
+  void* d_map = nullptr;
+  size_t d_maplen = 0;
+  std::string d_buffer; // fallback storage
+  std::string_view d_view;
+};
@@ -0,0 +1,15 @@
+#include "metricfilter.hh"
+using namespace std;
+
+bool MetricFilter::Rules::matches(std::string_view name) const
+{
+  if(exact.count(name))
+    return true;
+  for(const auto& p : prefixes)
+    if(name.substr(0, p.size()) == p)
+      return true;
+  for(const auto& re : regexes)
+    if(std::regex_match(name.begin(), name.end(), re))
+      return true;
+  return false;
+}
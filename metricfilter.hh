@@ -0,0 +1,37 @@
+#pragma once
+#include <regex>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/* Decides on metric names. If there are allow rules, a name has to match one
+   of them, and then it must not match any deny rule. Each kind is tried from
+   cheap to expensive: exact names, prefixes, regexes (anchored). */
+class MetricFilter
+{
+public:
+  void allow(std::string name) { d_allow.exact.insert(std::move(name)); }
+  void allowPrefix(std::string prefix) { d_allow.prefixes.push_back(std::move(prefix)); }
+  void allowRegex(const std::string& re) { d_allow.regexes.emplace_back(re, std::regex::optimize); }
+  void deny(std::string name) { d_deny.exact.insert(std::move(name)); }
+  void denyPrefix(std::string prefix) { d_deny.prefixes.push_back(std::move(prefix)); }
+  void denyRegex(const std::string& re) { d_deny.regexes.emplace_back(re, std::regex::optimize); }
+
+  bool accepts(std::string_view name) const
+  {
+    return (d_allow.empty() || d_allow.matches(name)) && !d_deny.matches(name);
+  }
+  bool empty() const { return d_allow.empty() && d_deny.empty(); }
+
+private:
+  struct Rules
+  {
+    bool matches(std::string_view name) const;
+    bool empty() const { return exact.empty() && prefixes.empty() && regexes.empty(); }
+    std::set<std::string, std::less<>> exact;
+    std::vector<std::string> prefixes;
+    std::vector<std::regex> regexes;
+  };
+  Rules d_allow, d_deny;
+};
@@ -0,0 +1,43 @@
+#include "promparser.hh"
+#include "mappedfile.hh"
+#include "jsonwriter.hh"
+#include "promjson.hh"
+#include <fmt/core.h>
+#include <chrono>
+#include <fcntl.h>
+#include <unistd.h>
+using namespace std;
+
+// measures prom2json --ndjson throughput, writing to /dev/null
+// run as ./ndjsonbench prometheus.txt [runs]
+
+int main(int argc, char** argv)
+{
+  if(argc < 2) {
+    fmt::print("Run as: ./ndjsonbench prometheus.txt [runs]\n");
+    return 0;
+  }
+  int runs = argc > 2 ? atoi(argv[2]) : 10;
+  PromParser pp;
+  MappedFile mf(argv[1]);
+  int fd = open("/dev/null", O_WRONLY);
+  if(fd < 0)
+    throw runtime_error("Unable to open /dev/null");
+
+  BufferedWriter out(fd, 1 << 20);
+  JsonWriter jw(out);
+  size_t samples = 0;
+  auto start = chrono::steady_clock::now();
+  for(int run = 0; run < runs; ++run) {
+    pp.parse(mf.view(), [&](const PromParser::PromSample& s) {
+      writeNdjson(jw, s);
+      out.append('\n');
+      samples++;
+    });
+  }
+  out.flush();
+  double sec = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  fmt::print("{} samples in {:.3f} s: {:.0f} samples/s, {:.1f} MB/s of input\n",
+             samples, sec, samples / sec, runs * mf.view().size() / sec / 1048576);
+  close(fd);
+}
@@ -807,9 +807,10 @@ public:
   ~Context() {
     pop_capture_scope();
 
-    assert(!value_stack_size);
-    assert(!capture_scope_stack_size);
-    assert(cut_stack.empty());
+    // an action that throws leaves the stacks as they were, which is fine
+    assert(std::uncaught_exceptions() || !value_stack_size);
+    assert(std::uncaught_exceptions() || !capture_scope_stack_size);
+    assert(std::uncaught_exceptions() || cut_stack.empty());
   }
 
   Context(const Context &) = delete;
@@ -2369,6 +2370,10 @@ public:
       predicate;
 
   size_t id = 0;
+  // Computed once when definition ids are assigned, so that Holder::parse_core
+  // needs no RTTI or name hashing per invocation
+  bool is_choice = false;
+  unsigned int tag = 0;
   Action action;
   std::function<void(const Context &c, const char *s, size_t n, std::any &dt)>
       enter;
@@ -2787,12 +2792,7 @@ inline size_t Holder::parse_core(const char *s, size_t n, SemanticValues &vs,
       chvs.sv_ = std::string_view(s, len);
       chvs.name_ = outer_->name;
 
-      auto ope_ptr = ope_.get();
-      {
-        auto tok_ptr = dynamic_cast<const peg::TokenBoundary *>(ope_ptr);
-        if (tok_ptr) { ope_ptr = tok_ptr->ope_.get(); }
-      }
-      if (!dynamic_cast<const peg::PrioritizedChoice *>(ope_ptr)) {
+      if (!outer_->is_choice) {
         chvs.choice_count_ = 0;
         chvs.choice_ = 0;
       }
@@ -2829,7 +2829,7 @@ inline size_t Holder::parse_core(const char *s, size_t n, SemanticValues &vs,
   if (success(len)) {
     if (!outer_->ignoreSemanticValue) {
       vs.emplace_back(std::move(val));
-      vs.tags.emplace_back(str2tag(outer_->name));
+      vs.tags.emplace_back(outer_->tag);
     }
   }
 
@@ -3085,6 +3085,15 @@ inline void AssignIDToDefinition::visit(Holder &ope) {
   auto id = ids.size();
   ids[p] = id;
   ope.outer_->id = id;
+
+  auto ope_ptr = ope.ope_.get();
+  if (auto tok_ptr = dynamic_cast<const TokenBoundary *>(ope_ptr)) {
+    ope_ptr = tok_ptr->ope_.get();
+  }
+  ope.outer_->is_choice =
+      dynamic_cast<const PrioritizedChoice *>(ope_ptr) != nullptr;
+  ope.outer_->tag = str2tag(ope.outer_->name);
+
   ope.ope_->accept(*this);
 }
 
@@ -0,0 +1,407 @@
+#include "pegtrace.hh"
+#include "jsonwriter.hh"
+#include "peglib.h"
+#include <algorithm>
+#include <queue>
+#include <fmt/core.h>
+using namespace std;
+
+static uint64_t nsecSince(std::chrono::steady_clock::time_point start)
+{
+  return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+}
+
+void RuleProfiler::attach(peg::parser& p)
+{
+  p.enable_trace(
+    [this](const peg::Ope& ope, const char*, size_t, const peg::SemanticValues&, const peg::Context&, const std::any&, std::any&) {
+      enter(ope);
+    },
+    [this](const peg::Ope& ope, const char*, size_t, const peg::SemanticValues&, const peg::Context&, const std::any&, size_t len, std::any&) {
+      leave(ope, len);
+    },
+    [this](std::any&) {
+      // a previous parse may have ended in an exception
+      d_stack.clear();
+      d_matched.clear();
+      d_parseStart = chrono::steady_clock::now();
+    },
+    [this](std::any&) {
+      d_parses++;
+      d_totalNsec += nsecSince(d_parseStart);
+    });
+}
+
+void RuleProfiler::reset()
+{
+  d_rules.clear();
+  d_stack.clear();
+  d_matched.clear();
+  d_parses = d_totalNsec = 0;
+}
+
+void RuleProfiler::enter(const peg::Ope& ope)
+{
+  d_matched.push_back(0);
+  auto holder = dynamic_cast<const peg::Holder*>(&ope);
+  if(!holder)
+    return;
+  uint32_t rule = holder->outer_->id;
+  if(rule >= d_rules.size())
+    d_rules.resize(rule + 1);
+  if(d_rules[rule].name.empty())
+    d_rules[rule].name = holder->outer_->name;
+  d_rules[rule].calls++;
+  d_stack.push_back({rule, chrono::steady_clock::now(), 0});
+}
+
+// What rules matched inside an operator is lost when the operator fails, and
+// is then charged to the rule around it. So a choice whose first alternative
+// parses a name and then fails adds the length of that name
+void RuleProfiler::leave(const peg::Ope& ope, size_t len)
+{
+  size_t matched = d_matched.back();
+  d_matched.pop_back();
+  if(!dynamic_cast<const peg::Holder*>(&ope)) {
+    if(peg::success(len)) {
+      if(!d_matched.empty())
+        d_matched.back() += matched;
+    }
+    else if(!d_stack.empty())
+      d_rules[d_stack.back().rule].bytesBacktracked += matched;
+    return;
+  }
+
+  Frame f = d_stack.back();
+  d_stack.pop_back();
+  uint64_t nsec = nsecSince(f.start);
+  auto& r = d_rules[f.rule];
+  r.inclusiveNsec += nsec;
+  r.exclusiveNsec += nsec > f.childNsec ? nsec - f.childNsec : 0;
+  if(peg::success(len)) {
+    r.successes++;
+    r.bytesConsumed += len;
+    if(!d_matched.empty())
+      d_matched.back() += len;
+  }
+  else {
+    r.failures++;
+    r.bytesBacktracked += matched;
+  }
+  if(!d_stack.empty())
+    d_stack.back().childNsec += nsec;
+}
+
+std::vector<size_t> RuleProfiler::sortedByName() const
+{
+  vector<size_t> order;
+  for(size_t n = 0; n < d_rules.size(); ++n)
+    if(d_rules[n].calls)
+      order.push_back(n);
+  sort(order.begin(), order.end(), [this](size_t a, size_t b) { return d_rules[a].name < d_rules[b].name; });
+  return order;
+}
+
+void RuleProfiler::writeJson(JsonWriter& jw) const
+{
+  jw.startObject();
+  jw.key("parses");
+  jw.value(int64_t(d_parses));
+  jw.key("total_nsec");
+  jw.value(int64_t(d_totalNsec));
+  jw.key("rules");
+  jw.startArray();
+  for(auto n : sortedByName()) {
+    const auto& r = d_rules[n];
+    jw.startObject();
+    jw.key("rule");
+    jw.value(r.name);
+    for(auto [k, v] : {pair{"calls", r.calls}, {"successes", r.successes}, {"failures", r.failures},
+                       {"inclusive_nsec", r.inclusiveNsec}, {"exclusive_nsec", r.exclusiveNsec},
+                       {"bytes_consumed", r.bytesConsumed}, {"bytes_backtracked", r.bytesBacktracked}}) {
+      jw.key(k);
+      jw.value(int64_t(v));
+    }
+    jw.endObject();
+  }
+  jw.endArray();
+  jw.endObject();
+}
+
+void RuleProfiler::writeCsv(BufferedWriter& out) const
+{
+  out.append("rule,calls,successes,failures,inclusive_nsec,exclusive_nsec,bytes_consumed,bytes_backtracked\n");
+  for(auto n : sortedByName()) {
+    const auto& r = d_rules[n];
+    out.append(fmt::format("{},{},{},{},{},{},{},{}\n", r.name, r.calls, r.successes, r.failures,
+                           r.inclusiveNsec, r.exclusiveNsec, r.bytesConsumed, r.bytesBacktracked));
+  }
+}
+
+FoldedStackTracer::FoldedStackTracer(Weight weight, size_t maxNodes, size_t maxDepth) :
+  d_weight(weight), d_maxNodes(maxNodes), d_maxDepth(maxDepth)
+{
+  reset();
+}
+
+void FoldedStackTracer::attach(peg::parser& p)
+{
+  p.enable_trace(
+    [this](const peg::Ope& ope, const char*, size_t, const peg::SemanticValues&, const peg::Context&, const std::any&, std::any&) {
+      enter(ope);
+    },
+    [this](const peg::Ope& ope, const char*, size_t, const peg::SemanticValues&, const peg::Context&, const std::any&, size_t, std::any&) {
+      leave(ope);
+    },
+    [this](std::any&) { d_stack.clear(); },
+    [](std::any&) {});
+}
+
+void FoldedStackTracer::reset()
+{
+  d_nodes.assign(1, {0, 0, 0});
+  d_children.clear();
+  d_stack.clear();
+  d_truncated = 0;
+}
+
+void FoldedStackTracer::enter(const peg::Ope& ope)
+{
+  auto holder = dynamic_cast<const peg::Holder*>(&ope);
+  if(!holder)
+    return;
+  uint32_t rule = holder->outer_->id;
+  if(rule >= d_ruleNames.size())
+    d_ruleNames.resize(rule + 1);
+  if(d_ruleNames[rule].empty())
+    d_ruleNames[rule] = holder->outer_->name;
+
+  uint32_t parent = d_stack.empty() ? 0 : d_stack.back().node;
+  uint32_t node = parent;
+  if(auto iter = d_children.find(uint64_t(parent) << 32 | rule); iter != d_children.end())
+    node = iter->second;
+  else if(d_nodes.size() <= d_maxNodes && d_stack.size() < d_maxDepth) {
+    node = d_nodes.size();
+    d_nodes.push_back({parent, rule, 0});
+    d_children[uint64_t(parent) << 32 | rule] = node;
+  }
+  else
+    d_truncated++;
+  if(d_weight == Weight::Calls)
+    d_nodes[node].weight++;
+  d_stack.push_back({node, chrono::steady_clock::now(), 0});
+}
+
+void FoldedStackTracer::leave(const peg::Ope& ope)
+{
+  if(!dynamic_cast<const peg::Holder*>(&ope))
+    return;
+  Frame f = d_stack.back();
+  d_stack.pop_back();
+  if(d_weight != Weight::Nsec)
+    return;
+  uint64_t nsec = nsecSince(f.start);
+  d_nodes[f.node].weight += nsec > f.childNsec ? nsec - f.childNsec : 0;
+  if(!d_stack.empty())
+    d_stack.back().childNsec += nsec;
+}
+
+void FoldedStackTracer::write(BufferedWriter& out) const
+{
+  vector<uint32_t> path;
+  string line;
+  for(uint32_t n = 1; n < d_nodes.size(); ++n) {
+    if(!d_nodes[n].weight)
+      continue;
+    path.clear();
+    for(uint32_t p = n; p; p = d_nodes[p].parent)
+      path.push_back(d_nodes[p].rule);
+    line.clear();
+    for(auto iter = path.rbegin(); iter != path.rend(); ++iter) {
+      if(!line.empty())
+        line += ';';
+      line += d_ruleNames[*iter];
+    }
+    out.append(fmt::format("{} {}\n", line, d_nodes[n].weight));
+  }
+}
+
+void ParseHeatmap::attach(peg::parser& p)
+{
+  p.enable_trace(
+    [this](const peg::Ope& ope, const char* s, size_t, const peg::SemanticValues&, const peg::Context& c, const std::any&, std::any&) {
+      if(c.s != d_input)
+        start(c.s, c.l);
+      enter(ope, s - c.s);
+    },
+    [this](const peg::Ope&, const char*, size_t, const peg::SemanticValues&, const peg::Context&, const std::any&, size_t len, std::any&) {
+      leave(len);
+    },
+    [this](std::any&) { d_input = nullptr; },
+    [this](std::any&) { finish(); });
+}
+
+void ParseHeatmap::start(const char* input, size_t size)
+{
+  d_input = input;
+  d_inputSize = size;
+  d_bytesVisited = 0;
+  d_entries.assign(size + 1, 0);
+  d_rules.clear();
+  d_seen.clear();
+  d_ruleBuckets.clear();
+  d_hasChildren.clear();
+  d_hotspots.clear();
+}
+
+void ParseHeatmap::enter(const peg::Ope& ope, size_t pos)
+{
+  if(!d_hasChildren.empty())
+    d_hasChildren.back() = true;
+  d_hasChildren.push_back(false);
+  auto holder = dynamic_cast<const peg::Holder*>(&ope);
+  if(!holder)
+    return;
+  uint32_t rule = holder->outer_->id;
+  if(rule >= d_rules.size()) {
+    d_rules.resize(rule + 1);
+    d_seen.resize(rule + 1);
+    d_ruleBuckets.resize(rule + 1);
+  }
+  auto& r = d_rules[rule];
+  if(r.name.empty()) {
+    r.name = holder->outer_->name;
+    d_seen[rule].resize(d_inputSize + 1);
+    d_ruleBuckets[rule].resize(d_inputSize / d_bucketBytes + 1);
+  }
+  r.entries++;
+  if(d_seen[rule][pos])
+    r.reentries++;
+  d_seen[rule][pos] = true;
+  d_ruleBuckets[rule][pos / d_bucketBytes]++;
+  d_entries[pos]++;
+}
+
+// operators without traced children are the terminals
+void ParseHeatmap::leave(size_t len)
+{
+  if(!d_hasChildren.back())
+    d_bytesVisited += peg::success(len) ? len : 1;
+  d_hasChildren.pop_back();
+}
+
+void ParseHeatmap::finish()
+{
+  if(!d_input)
+    return;
+  // a min-heap keeps the top offsets without sorting all of them
+  auto cmp = [](const Hotspot& a, const Hotspot& b) { return a.entries > b.entries; };
+  priority_queue<Hotspot, vector<Hotspot>, decltype(cmp)> top(cmp);
+  for(size_t pos = 0; pos < d_entries.size(); ++pos) {
+    if(!d_entries[pos] || (top.size() == d_numHotspots && d_entries[pos] <= top.top().entries))
+      continue;
+    top.push({pos, 0, 0, d_entries[pos]});
+    if(top.size() > d_numHotspots)
+      top.pop();
+  }
+  for(; !top.empty(); top.pop())
+    d_hotspots.push_back(top.top());
+
+  // one pass over the input for the line numbers, in offset order
+  sort(d_hotspots.begin(), d_hotspots.end(), [](const Hotspot& a, const Hotspot& b) { return a.offset < b.offset; });
+  size_t line = 1, lineStart = 0, pos = 0;
+  for(auto& h : d_hotspots) {
+    for(; pos < h.offset; ++pos) {
+      if(d_input[pos] == '\n') {
+        line++;
+        lineStart = pos + 1;
+      }
+    }
+    h.line = line;
+    h.column = h.offset - lineStart + 1;
+  }
+  sort(d_hotspots.begin(), d_hotspots.end(), [](const Hotspot& a, const Hotspot& b) {
+    return a.entries != b.entries ? a.entries > b.entries : a.offset < b.offset;
+  });
+
+  // there are few rules, so asking each of them is cheap
+  for(auto& h : d_hotspots) {
+    for(uint32_t rule = 0; rule < d_rules.size(); ++rule)
+      if(auto n = entries(rule, h.offset))
+        h.rules.push_back({rule, n});
+    sort(h.rules.begin(), h.rules.end(), [this](const RuleEntries& a, const RuleEntries& b) {
+      return a.entries != b.entries ? a.entries > b.entries : d_rules[a.rule].name < d_rules[b.rule].name;
+    });
+    if(h.rules.size() > d_rulesPerHotspot)
+      h.rules.resize(d_rulesPerHotspot);
+  }
+  d_input = nullptr;
+  d_seen.clear(); // only needed during the parse
+}
+
+uint32_t ParseHeatmap::entries(uint32_t rule, size_t offset) const
+{
+  if(rule >= d_ruleBuckets.size() || offset / d_bucketBytes >= d_ruleBuckets[rule].size())
+    return 0;
+  return d_ruleBuckets[rule][offset / d_bucketBytes];
+}
+
+void ParseHeatmap::writeJson(JsonWriter& jw) const
+{
+  jw.startObject();
+  jw.key("input_bytes");
+  jw.value(int64_t(d_inputSize));
+  jw.key("bytes_visited");
+  jw.value(int64_t(d_bytesVisited));
+  jw.key("amplification");
+  jw.value(amplification());
+  jw.key("bucket_bytes");
+  jw.value(int64_t(d_bucketBytes));
+  jw.key("rules");
+  jw.startArray();
+  vector<const Rule*> rules;
+  for(const auto& r : d_rules)
+    if(r.entries)
+      rules.push_back(&r);
+  sort(rules.begin(), rules.end(), [](const Rule* a, const Rule* b) {
+    return a->reentries != b->reentries ? a->reentries > b->reentries : a->name < b->name;
+  });
+  for(auto r : rules) {
+    jw.startObject();
+    jw.key("rule");
+    jw.value(r->name);
+    jw.key("entries");
+    jw.value(int64_t(r->entries));
+    jw.key("reentries");
+    jw.value(int64_t(r->reentries));
+    jw.endObject();
+  }
+  jw.endArray();
+  jw.key("hotspots");
+  jw.startArray();
+  for(const auto& h : d_hotspots) {
+    jw.startObject();
+    jw.key("offset");
+    jw.value(int64_t(h.offset));
+    jw.key("line");
+    jw.value(int64_t(h.line));
+    jw.key("column");
+    jw.value(int64_t(h.column));
+    jw.key("entries");
+    jw.value(int64_t(h.entries));
+    jw.key("rules");
+    jw.startArray();
+    for(const auto& r : h.rules) {
+      jw.startObject();
+      jw.key("rule");
+      jw.value(d_rules[r.rule].name);
+      jw.key("entries");
+      jw.value(int64_t(r.entries));
+      jw.endObject();
+    }
+    jw.endArray();
+    jw.endObject();
+  }
+  jw.endArray();
+  jw.endObject();
+}
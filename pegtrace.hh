@@ -0,0 +1,177 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace peg {
+  struct parser;
+  class Ope;
+}
+class JsonWriter;
+class BufferedWriter;
+
+/* Tools built on peg::parser::enable_trace(). Attaching one replaces any
+   tracer the parser had, and from then on it collects over every parse until
+   reset(). None of them are thread safe, so profile single threaded parses */
+
+// per rule counters and timings, a machine readable peg::enable_profiling()
+class RuleProfiler
+{
+public:
+  struct Rule
+  {
+    std::string name;
+    uint64_t calls = 0;
+    uint64_t successes = 0;
+    uint64_t failures = 0;
+    uint64_t inclusiveNsec = 0;    // counted at every level of a recursion
+    uint64_t exclusiveNsec = 0;    // minus the time spent in sub-rules
+    uint64_t bytesConsumed = 0;    // by successful matches
+    uint64_t bytesBacktracked = 0; // matched inside the rule, then thrown away
+  };
+
+  void attach(peg::parser& p);
+  void reset();
+
+  // indexed by rule id, rules that never ran have calls == 0
+  const std::vector<Rule>& rules() const { return d_rules; }
+  uint64_t parses() const { return d_parses; }
+  uint64_t totalNsec() const { return d_totalNsec; }
+
+  // rules sorted by name, so profiles of two grammar versions diff well
+  void writeJson(JsonWriter& jw) const;
+  void writeCsv(BufferedWriter& out) const;
+
+private:
+  struct Frame
+  {
+    uint32_t rule;
+    std::chrono::steady_clock::time_point start;
+    uint64_t childNsec;
+  };
+  void enter(const peg::Ope& ope);
+  void leave(const peg::Ope& ope, size_t len);
+  std::vector<size_t> sortedByName() const;
+
+  std::vector<Rule> d_rules;
+  std::vector<Frame> d_stack;     // one per rule being parsed
+  std::vector<size_t> d_matched;  // per operator being parsed, bytes matched by rules inside it
+  uint64_t d_parses = 0;
+  uint64_t d_totalNsec = 0;
+  std::chrono::steady_clock::time_point d_parseStart;
+};
+
+/* Aggregates rule stacks, as in Context::rule_stack, into the folded format
+   that flamegraph.pl and similar tools read: "root;vline;labels 1234". The
+   weight is exclusive nanoseconds or calls. Memory is bounded by maxNodes
+   distinct stacks and maxDepth rules per stack, what does not fit is charged
+   to the deepest stack that does, so any input size can be profiled */
+class FoldedStackTracer
+{
+public:
+  enum class Weight { Nsec, Calls };
+  explicit FoldedStackTracer(Weight weight = Weight::Nsec, size_t maxNodes = 100000, size_t maxDepth = 64);
+
+  void attach(peg::parser& p);
+  void reset();
+
+  size_t nodes() const { return d_nodes.size() - 1; }
+  uint64_t truncated() const { return d_truncated; } // rule entries charged to a parent stack
+  // one line per stack with a non-zero weight
+  void write(BufferedWriter& out) const;
+
+private:
+  struct Node
+  {
+    uint32_t parent;
+    uint32_t rule;
+    uint64_t weight;
+  };
+  struct Frame
+  {
+    uint32_t node;
+    std::chrono::steady_clock::time_point start;
+    uint64_t childNsec;
+  };
+  void enter(const peg::Ope& ope);
+  void leave(const peg::Ope& ope);
+
+  Weight d_weight;
+  size_t d_maxNodes;
+  size_t d_maxDepth;
+  std::vector<Node> d_nodes; // d_nodes[0] is the empty stack
+  std::unordered_map<uint64_t, uint32_t> d_children; // parent << 32 | rule -> node
+  std::vector<std::string> d_ruleNames; // by rule id
+  std::vector<Frame> d_stack;
+  uint64_t d_truncated = 0;
+};
+
+/* Shows where a parse re-reads its input. For the last parse it counts per
+   input offset how often a rule started there, per rule how often it started
+   at an offset it had already tried, and how many bytes the terminals looked
+   at in total. That total over the input size is the re-parse amplification,
+   a failed terminal counts as one byte. The offsets with the most rule starts
+   are reported with the rules that started most in the bucketBytes wide
+   bucket around them. Needs 4 bytes per input byte, plus for every rule a bit
+   per input byte during the parse and 4 bytes per bucket */
+class ParseHeatmap
+{
+public:
+  explicit ParseHeatmap(size_t hotspots = 20, size_t rulesPerHotspot = 5, size_t bucketBytes = 64) :
+    d_numHotspots(hotspots), d_rulesPerHotspot(rulesPerHotspot), d_bucketBytes(bucketBytes ? bucketBytes : 1) {}
+
+  struct Rule
+  {
+    std::string name;
+    uint64_t entries = 0;
+    uint64_t reentries = 0;  // entries at an offset this rule had started at before
+  };
+  struct RuleEntries
+  {
+    uint32_t rule; // index into rules()
+    uint32_t entries;
+  };
+  struct Hotspot
+  {
+    size_t offset;
+    size_t line;   // 1-based, like the parse errors
+    size_t column;
+    uint32_t entries;
+    std::vector<RuleEntries> rules; // in the bucket of offset, most entries first
+  };
+
+  void attach(peg::parser& p);
+
+  const std::vector<uint32_t>& entries() const { return d_entries; } // per offset, one more than the input size
+  const std::vector<Rule>& rules() const { return d_rules; }         // by rule id
+  const std::vector<Hotspot>& hotspots() const { return d_hotspots; } // most entries first
+  // how often rule started in the bucket that holds offset
+  uint32_t entries(uint32_t rule, size_t offset) const;
+  size_t bucketBytes() const { return d_bucketBytes; }
+  size_t inputSize() const { return d_inputSize; }
+  uint64_t bytesVisited() const { return d_bytesVisited; }
+  double amplification() const { return d_inputSize ? double(d_bytesVisited) / d_inputSize : 0; }
+
+  void writeJson(JsonWriter& jw) const;
+
+private:
+  void start(const char* input, size_t size);
+  void enter(const peg::Ope& ope, size_t pos);
+  void leave(size_t len);
+  void finish();
+
+  size_t d_numHotspots;
+  size_t d_rulesPerHotspot;
+  size_t d_bucketBytes;
+  const char* d_input = nullptr; // only valid during a parse
+  size_t d_inputSize = 0;
+  uint64_t d_bytesVisited = 0;
+  std::vector<uint32_t> d_entries;
+  std::vector<Rule> d_rules;
+  std::vector<std::vector<bool>> d_seen;          // per rule and offset, only during a parse
+  std::vector<std::vector<uint32_t>> d_ruleBuckets; // per rule, entries per bucket
+  std::vector<bool> d_hasChildren;       // per operator being parsed
+  std::vector<Hotspot> d_hotspots;
+};
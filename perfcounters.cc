@@ -0,0 +1,115 @@
+#include "perfcounters.hh"
+#include <cerrno>
+#include <cstring>
+#include <fmt/core.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+using namespace std;
+
+static int openCounter(uint32_t type, uint64_t config)
+{
+  perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = type;
+  attr.config = config;
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  return syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+}
+
+// value, time enabled, time running
+static bool readCounter(int fd, uint64_t (&buf)[3])
+{
+  return fd >= 0 && ::read(fd, buf, sizeof(buf)) == sizeof(buf);
+}
+
+PerfCounters::PerfCounters()
+{
+  static const pair<uint32_t, uint64_t> events[NumEvents] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES}
+  };
+  for(int n = 0; n < NumEvents; ++n) {
+    d_fds[n] = openCounter(events[n].first, events[n].second);
+    if(d_fds[n] < 0 && d_error.empty())
+      d_error = fmt::format("{}: {}", name(Event(n)), strerror(errno));
+  }
+}
+
+PerfCounters::~PerfCounters()
+{
+  for(int fd : d_fds)
+    if(fd >= 0)
+      close(fd);
+}
+
+bool PerfCounters::anyAvailable() const
+{
+  for(int fd : d_fds)
+    if(fd >= 0)
+      return true;
+  return false;
+}
+
+void PerfCounters::start()
+{
+  for(int fd : d_fds)
+    if(fd >= 0)
+      ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+}
+
+void PerfCounters::stop()
+{
+  for(int fd : d_fds)
+    if(fd >= 0)
+      ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+}
+
+void PerfCounters::reset()
+{
+  for(int n = 0; n < NumEvents; ++n) {
+    if(d_fds[n] < 0)
+      continue;
+    ioctl(d_fds[n], PERF_EVENT_IOC_RESET, 0);
+    uint64_t buf[3];
+    if(readCounter(d_fds[n], buf)) {
+      d_baseEnabled[n] = buf[1];
+      d_baseRunning[n] = buf[2];
+    }
+  }
+}
+
+uint64_t PerfCounters::value(Event e) const
+{
+  uint64_t buf[3];
+  if(!readCounter(d_fds[e], buf))
+    return 0;
+  uint64_t enabled = buf[1] - d_baseEnabled[e];
+  uint64_t running = buf[2] - d_baseRunning[e];
+  if(!running)
+    return 0;
+  if(running < enabled)
+    return uint64_t(double(buf[0]) * enabled / running);
+  return buf[0];
+}
+
+const char* PerfCounters::name(Event e)
+{
+  switch(e) {
+  case Cycles: return "cycles";
+  case Instructions: return "instructions";
+  case BranchMisses: return "branch_misses";
+  case L1dMisses: return "l1d_misses";
+  case LlcMisses: return "llc_misses";
+  case NumEvents: break;
+  }
+  return "unknown";
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+/* Hardware counters through Linux perf_event_open(), for this thread and user
+   space only. Containers and VMs often do not allow them, or only some of
+   them, so every counter can be unavailable and nothing here throws */
+class PerfCounters
+{
+public:
+  enum Event { Cycles, Instructions, BranchMisses, L1dMisses, LlcMisses, NumEvents };
+
+  PerfCounters();
+  ~PerfCounters();
+  PerfCounters(const PerfCounters&) = delete;
+  PerfCounters& operator=(const PerfCounters&) = delete;
+
+  bool available(Event e) const { return d_fds[e] >= 0; }
+  bool anyAvailable() const;
+  const std::string& error() const { return d_error; } // why the first unavailable counter is missing
+
+  // counts only between start() and stop(), adding up over several regions
+  void start();
+  void stop();
+  // zeroes the counts, and the times they are scaled with
+  void reset();
+  // scaled up if the kernel had to multiplex the counters, 0 if unavailable
+  uint64_t value(Event e) const;
+
+  static const char* name(Event e);
+
+private:
+  int d_fds[NumEvents];
+  // PERF_EVENT_IOC_RESET leaves the enabled and running times alone, so they
+  // count from what they were at the last reset()
+  uint64_t d_baseEnabled[NumEvents] = {};
+  uint64_t d_baseRunning[NumEvents] = {};
+  std::string d_error;
+};
@@ -0,0 +1,73 @@
+#include "promparser.hh"
+#include "expogen.hh"
+#include <fmt/core.h>
+#include <chrono>
+using namespace std;
+
+// compares building and tearing down a parse result with the default
+// allocator and with a monotonic_buffer_resource
+// run as ./pmrbench [--runs=N] [promgen options]
+
+static double msecSince(chrono::steady_clock::time_point start)
+{
+  return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char** argv)
+{
+  ExpoGenOptions opts;
+  opts.families = 500;
+  opts.series = 200;
+  int runs = 3;
+  for(int n = 1; n < argc; ++n) {
+    string_view arg(argv[n]);
+    if(arg.substr(0, 7) == "--runs=")
+      runs = max(1, atoi(argv[n] + 7));
+    else if(!parseExpoGenOption(arg, opts)) {
+      fmt::print(stderr, "Run as: ./pmrbench [--runs=N] [options]\n{}", expoGenUsage());
+      return EXIT_FAILURE;
+    }
+  }
+  string in = generateExposition(opts);
+  fmt::print("input: {} bytes, {} samples, {} runs\n", in.size(), size_t(opts.families) * opts.series, runs);
+
+  PromParser pp;
+  double build = 0, destroy = 0;
+  for(int run = 0; run < runs; ++run) {
+    auto start = chrono::steady_clock::now();
+    auto res = make_unique<PromParser::promparseres_t>(pp.parse(in));
+    build += msecSince(start);
+    start = chrono::steady_clock::now();
+    res.reset();
+    destroy += msecSince(start);
+  }
+  fmt::print("{:<10} build {:8.2f} ms  destroy {:8.2f} ms\n", "std", build / runs, destroy / runs);
+
+  build = destroy = 0;
+  std::pmr::monotonic_buffer_resource mr(in.size() * 4); // one upstream block for most inputs
+  for(int run = 0; run < runs; ++run) {
+    auto start = chrono::steady_clock::now();
+    auto res = make_unique<PromParser::pmrparseres_t>(pp.parse(in, &mr));
+    build += msecSince(start);
+    // the destructors still walk the tree, the memory goes in one release
+    start = chrono::steady_clock::now();
+    res.reset();
+    mr.release();
+    destroy += msecSince(start);
+  }
+  fmt::print("{:<10} build {:8.2f} ms  destroy {:8.2f} ms\n", "pmr", build / runs, destroy / runs);
+
+  // nothing in the result has a destructor with side effects other than
+  // freeing memory, so with the result itself in the arena they can be skipped
+  build = destroy = 0;
+  for(int run = 0; run < runs; ++run) {
+    auto start = chrono::steady_clock::now();
+    void* place = mr.allocate(sizeof(PromParser::pmrparseres_t), alignof(PromParser::pmrparseres_t));
+    new(place) PromParser::pmrparseres_t(pp.parse(in, &mr));
+    build += msecSince(start);
+    start = chrono::steady_clock::now();
+    mr.release();
+    destroy += msecSince(start);
+  }
+  fmt::print("{:<10} build {:8.2f} ms  destroy {:8.2f} ms\n", "pmr wink", build / runs, destroy / runs);
+}
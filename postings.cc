@@ -0,0 +1,249 @@
+#include "postings.hh"
+#include <algorithm>
+#include <stdexcept>
+using namespace std;
+
+static void putVarint(std::vector<uint8_t>& out, uint32_t v)
+{
+  while(v >= 0x80) {
+    out.push_back(v | 0x80);
+    v >>= 7;
+  }
+  out.push_back(v);
+}
+
+static uint32_t getVarint(const uint8_t*& p)
+{
+  uint32_t ret = 0;
+  for(int shift = 0;; shift += 7) {
+    uint8_t b = *p++;
+    ret |= uint32_t(b & 0x7f) << shift;
+    if(!(b & 0x80))
+      return ret;
+  }
+}
+
+void Postings::append(uint32_t id)
+{
+  putVarint(d_data, d_count ? id - d_last : id);
+  d_last = id;
+  d_count++;
+}
+
+void Postings::add(uint32_t id)
+{
+  if(!d_count || id > d_last) {
+    append(id);
+    return;
+  }
+  // a reused id, happens after series were removed
+  auto iter = lower_bound(d_pending.begin(), d_pending.end(), id);
+  if(iter != d_pending.end() && *iter == id)
+    return;
+  d_pending.insert(iter, id);
+  // re-encoding costs the whole list, so only do that once it pays off
+  if(d_pending.size() >= max<size_t>(64, d_count / 8)) {
+    vector<uint32_t> ids;
+    decode(ids);
+    encode(ids);
+  }
+}
+
+void Postings::remove(const std::vector<uint32_t>& ids)
+{
+  vector<uint32_t> all;
+  decode(all);
+  vector<uint32_t> rest;
+  rest.reserve(all.size());
+  set_difference(all.begin(), all.end(), ids.begin(), ids.end(), back_inserter(rest));
+  if(rest.size() != all.size() || !d_pending.empty())
+    encode(rest);
+}
+
+void Postings::encode(const std::vector<uint32_t>& ids)
+{
+  d_data.clear();
+  d_pending.clear();
+  d_count = 0;
+  for(auto id : ids)
+    append(id);
+}
+
+void Postings::decode(std::vector<uint32_t>& out) const
+{
+  size_t start = out.size();
+  out.reserve(out.size() + size());
+  const uint8_t* p = d_data.data();
+  uint32_t id = 0;
+  for(uint32_t n = 0; n < d_count; ++n) {
+    id += getVarint(p);
+    out.push_back(id);
+  }
+  if(!d_pending.empty()) {
+    size_t mid = out.size();
+    out.insert(out.end(), d_pending.begin(), d_pending.end());
+    inplace_merge(out.begin() + start, out.begin() + mid, out.end());
+  }
+}
+
+std::vector<uint32_t> intersectPostings(const std::vector<uint32_t>& a, const std::vector<uint32_t>& b)
+{
+  if(a.size() > b.size())
+    return intersectPostings(b, a);
+  vector<uint32_t> ret;
+  auto pos = b.begin();
+  for(auto id : a) {
+    // gallop: double the step until we pass id, then binary search that stretch
+    size_t step = 1;
+    auto hi = pos;
+    while(hi != b.end() && *hi < id) {
+      pos = hi;
+      hi = (size_t)(b.end() - hi) > step ? hi + step : b.end();
+      step *= 2;
+    }
+    pos = lower_bound(pos, hi, id);
+    if(pos == b.end())
+      break;
+    if(*pos == id)
+      ret.push_back(id);
+  }
+  return ret;
+}
+
+std::vector<uint32_t> mergePostings(const std::vector<uint32_t>& a, const std::vector<uint32_t>& b)
+{
+  vector<uint32_t> ret;
+  ret.reserve(a.size() + b.size());
+  set_union(a.begin(), a.end(), b.begin(), b.end(), back_inserter(ret));
+  return ret;
+}
+
+std::vector<uint32_t> subtractPostings(const std::vector<uint32_t>& a, const std::vector<uint32_t>& b)
+{
+  vector<uint32_t> ret;
+  set_difference(a.begin(), a.end(), b.begin(), b.end(), back_inserter(ret));
+  return ret;
+}
+
+LabelMatcher::LabelMatcher(Type t, std::string n, std::string v)
+  : type(t), name(std::move(n)), value(std::move(v))
+{
+  if(type == Type::Regex || type == Type::NotRegex)
+    re = std::regex(value, std::regex::ECMAScript | std::regex::optimize);
+}
+
+bool LabelMatcher::matches(std::string_view v) const
+{
+  switch(type) {
+  case Type::Equal: return v == value;
+  case Type::NotEqual: return v != value;
+  case Type::Regex: return std::regex_match(v.begin(), v.end(), re);
+  case Type::NotRegex: return !std::regex_match(v.begin(), v.end(), re);
+  }
+  return false;
+}
+
+Postings& PostingsIndex::postings(std::string_view name, std::string_view value)
+{
+  auto iter = d_index.find(name);
+  if(iter == d_index.end())
+    iter = d_index.emplace(string(name), map<string, Postings, less<>>()).first;
+  auto viter = iter->second.find(value);
+  if(viter == iter->second.end())
+    viter = iter->second.emplace(string(value), Postings()).first;
+  return viter->second;
+}
+
+void PostingsIndex::add(uint32_t id, std::string_view name, const std::map<std::string, std::string>& labels)
+{
+  d_all.add(id);
+  postings("__name__", name).add(id);
+  for(const auto& [k, v] : labels)
+    postings(k, v).add(id);
+}
+
+void PostingsIndex::remove(uint32_t id, std::string_view name, const std::map<std::string, std::string>& labels)
+{
+  remove(vector<SeriesRef>{{id, name, &labels}});
+}
+
+void PostingsIndex::remove(const std::vector<SeriesRef>& series)
+{
+  // the ids to drop per label pair, the views point into 'series'
+  map<pair<string_view, string_view>, vector<uint32_t>> drops;
+  vector<uint32_t> all;
+  for(const auto& s : series) {
+    all.push_back(s.id);
+    drops[{"__name__", s.name}].push_back(s.id);
+    for(const auto& [k, v] : *s.labels)
+      drops[{k, v}].push_back(s.id);
+  }
+  sort(all.begin(), all.end());
+  d_all.remove(all);
+
+  for(auto& [kv, ids] : drops) {
+    auto iter = d_index.find(kv.first);
+    if(iter == d_index.end())
+      continue;
+    auto viter = iter->second.find(kv.second);
+    if(viter == iter->second.end())
+      continue;
+    sort(ids.begin(), ids.end());
+    viter->second.remove(ids);
+    if(viter->second.empty())
+      iter->second.erase(viter);
+    if(iter->second.empty())
+      d_index.erase(iter);
+  }
+}
+
+// all series with label m.name set to a value that does (or does not) match
+std::vector<uint32_t> PostingsIndex::unionOf(const LabelMatcher& m, bool matching) const
+{
+  vector<uint32_t> ret;
+  auto iter = d_index.find(m.name);
+  if(iter == d_index.end())
+    return ret;
+  vector<uint32_t> ids;
+  for(const auto& [value, p] : iter->second) {
+    if(m.matches(value) != matching)
+      continue;
+    ids.clear();
+    p.decode(ids);
+    ret = ret.empty() ? std::move(ids) : mergePostings(ret, ids);
+  }
+  return ret;
+}
+
+std::vector<uint32_t> PostingsIndex::select(const std::vector<LabelMatcher>& matchers) const
+{
+  // matchers that accept "" also match series without the label, those are
+  // applied by removing the series whose value they reject
+  vector<uint32_t> ret;
+  bool first = true;
+  for(const auto& m : matchers) {
+    if(m.matches(""))
+      continue;
+    auto ids = unionOf(m, true);
+    ret = first ? std::move(ids) : intersectPostings(ret, ids);
+    first = false;
+    if(ret.empty())
+      return ret;
+  }
+  if(first)
+    d_all.decode(ret);
+  for(const auto& m : matchers) {
+    if(m.matches(""))
+      ret = subtractPostings(ret, unionOf(m, false));
+  }
+  return ret;
+}
+
+size_t PostingsIndex::bytes() const
+{
+  size_t ret = d_all.bytes();
+  for(const auto& [name, values] : d_index)
+    for(const auto& [value, p] : values)
+      ret += p.bytes();
+  return ret;
+}
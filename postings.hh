@@ -0,0 +1,78 @@
+#pragma once
+#include <cstdint>
+#include <map>
+#include <regex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/* a sorted list of series ids, stored as varint encoded deltas. Ids below the
+   last one, which show up once ids of removed series are reused, wait in a
+   small sorted vector and are merged into the encoding in batches */
+class Postings
+{
+public:
+  // cheap if id is larger than all ids so far, id must not be in the list yet
+  void add(uint32_t id);
+  void remove(uint32_t id) { remove(std::vector<uint32_t>{id}); }
+  // ids sorted, decodes and encodes the list only once for all of them
+  void remove(const std::vector<uint32_t>& ids);
+  void decode(std::vector<uint32_t>& out) const; // appends
+  uint32_t size() const { return d_count + d_pending.size(); }
+  size_t bytes() const { return d_data.size() + d_pending.size() * sizeof(uint32_t); }
+  bool empty() const { return !size(); }
+
+private:
+  void append(uint32_t id);
+  void encode(const std::vector<uint32_t>& ids);
+  std::vector<uint8_t> d_data;
+  std::vector<uint32_t> d_pending; // sorted, not in d_data
+  uint32_t d_last = 0;
+  uint32_t d_count = 0;
+};
+
+// both inputs sorted, galloping through the larger list
+std::vector<uint32_t> intersectPostings(const std::vector<uint32_t>& a, const std::vector<uint32_t>& b);
+std::vector<uint32_t> mergePostings(const std::vector<uint32_t>& a, const std::vector<uint32_t>& b);
+std::vector<uint32_t> subtractPostings(const std::vector<uint32_t>& a, const std::vector<uint32_t>& b);
+
+// like a PromQL selector term, the regexes are anchored
+struct LabelMatcher
+{
+  enum class Type { Equal, NotEqual, Regex, NotRegex };
+  LabelMatcher(Type type, std::string name, std::string value);
+  bool matches(std::string_view v) const;
+
+  Type type;
+  std::string name;
+  std::string value;
+  std::regex re;
+};
+
+/* Inverted index from (label name, label value) to postings. The metric name
+   is indexed as label __name__. As in Prometheus, a series without a label
+   has that label set to "", so {foo=""} and {foo!="x"} match it */
+class PostingsIndex
+{
+public:
+  void add(uint32_t id, std::string_view name, const std::map<std::string, std::string>& labels);
+  void remove(uint32_t id, std::string_view name, const std::map<std::string, std::string>& labels);
+  struct SeriesRef
+  {
+    uint32_t id;
+    std::string_view name;
+    const std::map<std::string, std::string>* labels;
+  };
+  // rewrites every affected postings list once, instead of once per series
+  void remove(const std::vector<SeriesRef>& series);
+  // sorted ids of series that match all matchers
+  std::vector<uint32_t> select(const std::vector<LabelMatcher>& matchers) const;
+  size_t bytes() const;
+
+private:
+  Postings& postings(std::string_view name, std::string_view value);
+  std::vector<uint32_t> unionOf(const LabelMatcher& m, bool matching) const;
+
+  Postings d_all;
+  std::map<std::string, std::map<std::string, Postings, std::less<>>, std::less<>> d_index;
+};
@@ -0,0 +1,55 @@
+#include "postings.hh"
+#include <fmt/core.h>
+#include <chrono>
+using namespace std;
+
+// builds an index of synthetic series and times a few selectors
+// run as ./postingsbench [series]
+
+template<typename F>
+static double msec(F f)
+{
+  auto start = chrono::steady_clock::now();
+  f();
+  return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char** argv)
+{
+  uint32_t nseries = argc > 1 ? atoi(argv[1]) : 1000000;
+  const char* archs[] = {"amd64", "arm64", "riscv64"};
+  PostingsIndex idx;
+  double build = msec([&]() {
+    map<string, string> labels;
+    for(uint32_t id = 0; id < nseries; ++id) {
+      labels["job"] = fmt::format("job{}", id % 10);
+      labels["instance"] = fmt::format("host{}:9100", id / 100);
+      labels["arch"] = archs[id % 3];
+      if(id % 7 == 0)
+        labels["env"] = "staging";
+      else
+        labels.erase("env");
+      idx.add(id, fmt::format("metric_{}", id % 100), labels);
+    }
+  });
+  fmt::print("{} series indexed in {:.1f} ms, {:.1f} MB of postings ({:.2f} bytes/entry)\n",
+             nseries, build, idx.bytes() / 1048576.0, double(idx.bytes()) / (nseries * 5.0));
+
+  using T = LabelMatcher::Type;
+  vector<pair<string, vector<LabelMatcher>>> queries{
+    {"{job=\"job3\",arch=\"amd64\"}", {{T::Equal, "job", "job3"}, {T::Equal, "arch", "amd64"}}},
+    {"metric_7{instance=\"host42:9100\"}", {{T::Equal, "__name__", "metric_7"}, {T::Equal, "instance", "host42:9100"}}},
+    {"{job=\"job1\",arch!=\"arm64\"}", {{T::Equal, "job", "job1"}, {T::NotEqual, "arch", "arm64"}}},
+    {"{arch=~\"arm.*|riscv.*\",env=\"\"}", {{T::Regex, "arch", "arm.*|riscv.*"}, {T::Equal, "env", ""}}},
+    {"{instance=~\"host1[0-9]:9100\"}", {{T::Regex, "instance", "host1[0-9]:9100"}}},
+  };
+  for(const auto& [desc, matchers] : queries) {
+    size_t found = 0;
+    int runs = 10;
+    double t = msec([&]() {
+      for(int n = 0; n < runs; ++n)
+        found = idx.select(matchers).size();
+    });
+    fmt::print("{:<40} {:10} series {:10.3f} ms\n", desc, found, t / runs);
+  }
+}
@@ -1,45 +1,79 @@
 #include "promparser.hh"
+#include "mappedfile.hh"
+#include "jsonwriter.hh"
+#include "promjson.hh"
 #include <fmt/ranges.h>
-#include <fstream>
-#include <nlohmann/json.hpp>
+#include <map>
 
 using namespace std;
 
-static string readFileFrom(const char* fname)
-{
-  std::ifstream t(fname);
-  std::stringstream buffer;
-  buffer << t.rdbuf();
-  return buffer.str();
-}
-
 int main(int argc, char** argv)
 {
-  if(argc != 2) {
-    fmt::print("Run as: ./promparse prometheus.txt\n");
+  if(argc < 2) {
+    fmt::print("Run as: ./promparse [--ndjson] prometheus.txt [more.txt ...], use - for stdin\n");
     return 0;
   }
   
   PromParser pp;
-  auto result = pp.parse(readFileFrom(argv[1]));
-  //fmt::print("Got {} names\n", result.size());
+  if(argv[1] == string("--ndjson")) {
+    // one line per sample, written while parsing
+    BufferedWriter out(1, 1 << 20);
+    JsonWriter jw(out);
+    for(int n = 2; n < argc; ++n) {
+      MappedFile mf(argv[n]);
+      pp.parse(mf.view(), [&](const PromParser::PromSample& s) {
+        writeNdjson(jw, s);
+        out.append('\n');
+      });
+    }
+    out.flush();
+    return 0;
+  }
+
+  if(argc == 2) {
+    MappedFile mf(argv[1]);
+    auto result = pp.parse(mf.view());
+    //fmt::print("Got {} names\n", result.size());
+    BufferedWriter out(1);
+    JsonWriter jw(out, 1);
+    writeJson(jw, result);
+    out.append('\n');
+    out.flush();
+    return 0;
+  }
+
+  // several files get parsed in parallel, output is an object keyed by filename
+  // views are taken once all files are open, moving a MappedFile that read
+  // a small input into its string would leave earlier views dangling
+  vector<MappedFile> files;
+  for(int n = 1; n < argc; ++n)
+    files.emplace_back(argv[n]);
+  vector<string_view> ins;
+  for(const auto& mf : files)
+    ins.push_back(mf.view());
+  auto results = pp.parseBatch(ins);
 
-  nlohmann::json j;
-  for(auto& r : result) {
-    nlohmann::json inner;
-    inner["help"] = r.second.help;
-    inner["type"] = r.second.type;
+  map<string, size_t> order; // keys come out sorted, duplicates once
+  for(int n = 1; n < argc; ++n)
+    order[argv[n]] = n - 1;
 
-    nlohmann::json values = nlohmann::json::array();
-    for(auto& v : r.second.vals) {
-      nlohmann::json value;
-      value["labels"] = v.first;
-      value["value"] = v.second.value;
-      value["timestamp"] = v.second.tstampmsec;
-      values.push_back(value);
+  BufferedWriter out(1);
+  JsonWriter jw(out, 1);
+  jw.startObject();
+  for(const auto& [fname, idx] : order) {
+    auto& r = results[idx];
+    jw.key(fname);
+    if(r.error.empty())
+      writeJson(jw, r.result);
+    else {
+      fmt::print(stderr, "{}: {}\n", fname, r.error);
+      jw.startObject();
+      jw.key("error");
+      jw.value(r.error);
+      jw.endObject();
     }
-    inner["values"]=values;
-    j[r.first] = inner;
   }
-  fmt::print("{}\n", j.dump(1));
+  jw.endObject();
+  out.append('\n');
+  out.flush();
 }
@@ -0,0 +1,39 @@
+#include "promparser.hh"
+#include "promsnap.hh"
+#include "mappedfile.hh"
+#include <fmt/core.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+using namespace std;
+
+// writes to a temporary file first, so readers never see a partial snapshot
+static void writeFileAtomic(const string& fname, const string& content)
+{
+  string tmp = fname + ".tmp";
+  FILE* fp = fopen(tmp.c_str(), "w");
+  if(!fp)
+    throw runtime_error("Unable to open '"+tmp+"' for writing: "+strerror(errno));
+  if(fwrite(content.data(), 1, content.size(), fp) != content.size()) {
+    fclose(fp);
+    throw runtime_error("Unable to write '"+tmp+"': "+strerror(errno));
+  }
+  if(fclose(fp))
+    throw runtime_error("Unable to close '"+tmp+"': "+strerror(errno));
+  if(rename(tmp.c_str(), fname.c_str()))
+    throw runtime_error("Unable to rename '"+tmp+"': "+strerror(errno));
+}
+
+int main(int argc, char** argv)
+{
+  if(argc != 3) {
+    fmt::print("Run as: ./prom2snap prometheus.txt prometheus.snap\n");
+    return 0;
+  }
+  PromParser pp;
+  MappedFile mf(argv[1]);
+  auto snap = makePromSnapshot(pp.parse(mf.view()));
+  writeFileAtomic(argv[2], snap);
+}
@@ -0,0 +1,218 @@
+#include "promparser.hh"
+#include "promcolumns.hh"
+#include "mappedfile.hh"
+#include "jsonwriter.hh"
+#include "expogen.hh"
+#include "allocstats.hh"
+#include "perfcounters.hh"
+#include <fmt/core.h>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <optional>
+using namespace std;
+
+// parses a synthetic or given exposition with each way PromParser offers,
+// and reports throughput, allocations and latency percentiles
+// run as ./prombench [--json] [--perf] [--runs=N] [--file=name] [promgen options]
+// --perf adds hardware counters where the kernel allows them
+
+struct Result
+{
+  string engine;
+  double p50; // msec
+  double p99;
+  double mbps;
+  double samplesps;
+  double allocsPerSample;
+  double allocBytesPerByte;
+  AllocSnapshot allocs; // of one run
+  double perf[PerfCounters::NumEvents]; // per run, negative if unavailable
+};
+
+int main(int argc, char** argv)
+{
+  ExpoGenOptions opts;
+  bool json = false;
+  bool perf = false;
+  int runs = 20;
+  string fname;
+  for(int n = 1; n < argc; ++n) {
+    string_view arg(argv[n]);
+    if(arg == "--json")
+      json = true;
+    else if(arg == "--perf")
+      perf = true;
+    else if(arg.substr(0, 7) == "--runs=")
+      runs = max(1, atoi(argv[n] + 7));
+    else if(arg.substr(0, 7) == "--file=")
+      fname = arg.substr(7);
+    else if(!parseExpoGenOption(arg, opts)) {
+      fmt::print(stderr, "Run as: ./prombench [--json] [--perf] [--runs=N] [--file=name] [options]\n{}", expoGenUsage());
+      return EXIT_FAILURE;
+    }
+  }
+
+  string generated;
+  optional<MappedFile> mf;
+  string_view in;
+  if(fname.empty()) {
+    generated = generateExposition(opts);
+    in = generated;
+  }
+  else {
+    mf.emplace(fname);
+    in = mf->view();
+  }
+
+  PromParser pp;
+  pp.enableAllocPhases();
+  size_t samples = 0;
+  pp.parse(in, [&](const PromParser::PromSample&) { samples++; });
+  if(!samples)
+    throw runtime_error("Input has no samples");
+
+  PromColumns cols;
+  PromParser::promparseres_t reused;
+  vector<pair<string, function<void()>>> engines{
+    {"map", [&]() { pp.parse(in); }},
+    {"into", [&]() { pp.parseInto(in, reused); }},
+    {"callback", [&]() { pp.parse(in, [](const PromParser::PromSample&) {}); }},
+    {"columns", [&]() { cols.clear(); cols.parse(pp, in); }}
+  };
+
+  optional<PerfCounters> pc;
+  if(perf) {
+    pc.emplace();
+    if(!pc->anyAvailable())
+      fmt::print(stderr, "No perf counters available: {}\n", pc->error());
+    else if(!pc->error().empty())
+      fmt::print(stderr, "Not all perf counters are available: {}\n", pc->error());
+  }
+
+  vector<Result> results;
+  for(auto& [name, f] : engines) {
+    f(); // warm up, PromColumns fills its dictionary here
+    vector<double> msecs;
+    msecs.reserve(runs); // keeps the harness out of the allocation counts
+    if(pc)
+      pc->reset();
+    auto before = allocSnapshot();
+    for(int run = 0; run < runs; ++run) {
+      if(pc)
+        pc->start();
+      auto start = chrono::steady_clock::now();
+      f();
+      msecs.push_back(chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+      if(pc)
+        pc->stop();
+    }
+    auto allocs = allocSnapshot() - before;
+    for(auto& c : allocs.phases) {
+      c.allocs /= runs;
+      c.bytes /= runs;
+    }
+    sort(msecs.begin(), msecs.end());
+    double p50 = msecs[msecs.size() / 2];
+    double p99 = msecs[min(msecs.size() - 1, msecs.size() * 99 / 100)];
+    results.push_back({name, p50, p99, in.size() / p50 * 1000 / 1048576, samples / p50 * 1000,
+                       double(allocs.total().allocs) / samples, double(allocs.total().bytes) / in.size(), allocs, {}});
+    for(int e = 0; e < PerfCounters::NumEvents; ++e)
+      results.back().perf[e] = pc && pc->available(PerfCounters::Event(e)) ? double(pc->value(PerfCounters::Event(e))) / runs : -1;
+  }
+
+  // IPC and per input byte figures, only those whose counters we have
+  auto perfFigures = [&](const Result& r) {
+    vector<pair<string, double>> ret;
+    const double* v = r.perf;
+    if(v[PerfCounters::Cycles] > 0 && v[PerfCounters::Instructions] >= 0)
+      ret.emplace_back("ipc", v[PerfCounters::Instructions] / v[PerfCounters::Cycles]);
+    for(int e = 0; e < PerfCounters::NumEvents; ++e)
+      if(v[e] >= 0)
+        ret.emplace_back(fmt::format("{}_per_byte", PerfCounters::name(PerfCounters::Event(e))), v[e] / in.size());
+    return ret;
+  };
+
+  if(!json) {
+    fmt::print("input: {} bytes, {} samples, {} runs\n", in.size(), samples, runs);
+    for(const auto& r : results)
+      fmt::print("{:<10} p50 {:8.2f} ms  p99 {:8.2f} ms {:8.1f} MB/s {:12.0f} samples/s {:8.2f} allocs/sample {:6.2f} alloc bytes/byte\n",
+                 r.engine, r.p50, r.p99, r.mbps, r.samplesps, r.allocsPerSample, r.allocBytesPerByte);
+    if(pc && pc->anyAvailable()) {
+      for(const auto& r : results) {
+        fmt::print("{:<10}", r.engine);
+        for(const auto& [k, v] : perfFigures(r))
+          fmt::print(" {} {:.3f}", k, v);
+        fmt::print("\n");
+      }
+    }
+    return 0;
+  }
+  BufferedWriter out(1);
+  JsonWriter jw(out, 2);
+  jw.startObject();
+  jw.key("input");
+  jw.startObject();
+  jw.key("source");
+  jw.value(fname.empty() ? string_view("promgen") : string_view(fname));
+  if(fname.empty()) {
+    jw.key("seed");
+    jw.value(int64_t(opts.seed));
+  }
+  jw.key("bytes");
+  jw.value(int64_t(in.size()));
+  jw.key("samples");
+  jw.value(int64_t(samples));
+  jw.key("runs");
+  jw.value(int64_t(runs));
+  jw.endObject();
+  jw.key("engines");
+  jw.startArray();
+  for(const auto& r : results) {
+    jw.startObject();
+    jw.key("engine");
+    jw.value(r.engine);
+    jw.key("p50_msec");
+    jw.value(r.p50);
+    jw.key("p99_msec");
+    jw.value(r.p99);
+    jw.key("mb_per_sec");
+    jw.value(r.mbps);
+    jw.key("samples_per_sec");
+    jw.value(r.samplesps);
+    jw.key("allocs_per_sample");
+    jw.value(r.allocsPerSample);
+    jw.key("alloc_bytes_per_byte");
+    jw.value(r.allocBytesPerByte);
+    jw.key("allocs_per_phase");
+    jw.startObject();
+    for(size_t n = 0; n < size_t(AllocPhase::Count); ++n) {
+      jw.key(allocPhaseName(AllocPhase(n)));
+      jw.startObject();
+      jw.key("allocs");
+      jw.value(int64_t(r.allocs.phases[n].allocs));
+      jw.key("bytes");
+      jw.value(int64_t(r.allocs.phases[n].bytes));
+      jw.endObject();
+    }
+    jw.endObject();
+    if(pc) {
+      jw.key("perf");
+      if(!pc->anyAvailable())
+        jw.null();
+      else {
+        jw.startObject();
+        for(const auto& [k, v] : perfFigures(r)) {
+          jw.key(k);
+          jw.value(v);
+        }
+        jw.endObject();
+      }
+    }
+    jw.endObject();
+  }
+  jw.endArray();
+  jw.endObject();
+  out.append('\n');
+  out.flush();
+}
@@ -0,0 +1,43 @@
+#include "promcolumns.hh"
+using namespace std;
+
+uint32_t PromColumns::ref(const PromParser::PromSample& s)
+{
+  d_key.assign(s.name);
+  for(const auto& [name, value] : s.labels) {
+    d_key += '\0';
+    d_key += name;
+    d_key += '\0';
+    d_key += value;
+  }
+  if(auto iter = d_index.find(d_key); iter != d_index.end())
+    return iter->second;
+
+  uint32_t ret = d_series.size();
+  d_series.push_back({s.name, s.labels});
+  d_index.emplace(d_key, ret);
+  return ret;
+}
+
+void PromColumns::parse(const PromParser& pp, std::string_view in)
+{
+  pp.parse(in, [this](const PromParser::PromSample& s) {
+    values.push_back(s.value);
+    timestamps.push_back(s.tstampmsec);
+    seriesRefs.push_back(ref(s));
+  });
+}
+
+void PromColumns::clear()
+{
+  values.clear();
+  timestamps.clear();
+  seriesRefs.clear();
+}
+
+void PromColumns::clearDictionary()
+{
+  clear();
+  d_series.clear();
+  d_index.clear();
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include "promparser.hh"
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/* Samples of a scrape as columns, for bulk ingest. Row n of values,
+   timestamps and seriesRefs is one sample, seriesRefs points into a
+   dictionary of distinct series (name plus labels).
+
+   The columns are cleared by every parse but keep their capacity. The
+   dictionary is kept too, so a series gets the same ref in every scrape
+   that is parsed into the same PromColumns. */
+
+class PromColumns
+{
+public:
+  struct Series
+  {
+    std::string name;
+    std::map<std::string, std::string> labels;
+  };
+
+  // appends to the columns, use clear() first to start a new batch
+  void parse(const PromParser& pp, std::string_view in);
+  void clear();          // empties the columns, keeps dictionary and capacity
+  void clearDictionary(); // also forgets all series
+
+  std::vector<double> values;
+  std::vector<int64_t> timestamps;
+  std::vector<uint32_t> seriesRefs;
+
+  const Series& series(uint32_t ref) const { return d_series[ref]; }
+  size_t numSeries() const { return d_series.size(); }
+
+private:
+  uint32_t ref(const PromParser::PromSample& s);
+
+  std::vector<Series> d_series;
+  std::unordered_map<std::string, uint32_t> d_index; // keyed on name and labels joined by \0
+  std::string d_key; // scratch, so lookups do not allocate
+};
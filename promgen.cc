@@ -0,0 +1,21 @@
+#include "expogen.hh"
+#include "jsonwriter.hh"
+#include <fmt/core.h>
+using namespace std;
+
+// writes a deterministic synthetic exposition to stdout
+// run as ./promgen [options] > synthetic.txt
+
+int main(int argc, char** argv)
+{
+  ExpoGenOptions opts;
+  for(int n = 1; n < argc; ++n) {
+    if(!parseExpoGenOption(argv[n], opts)) {
+      fmt::print(stderr, "Run as: ./promgen [options]\n{}", expoGenUsage());
+      return EXIT_FAILURE;
+    }
+  }
+  BufferedWriter out(1);
+  out.append(generateExposition(opts));
+  out.flush();
+}
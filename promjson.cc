@@ -0,0 +1,66 @@
+#include "promjson.hh"
+
+// same layout nlohmann::json used to produce, its objects have sorted keys
+void writeJson(JsonWriter& jw, const PromParser::promparseres_t& result)
+{
+  if(result.empty()) {
+    jw.null();
+    return;
+  }
+  jw.startObject();
+  for(auto& r : result) {
+    writeJsonFamilyStart(jw, r.first, r.second.help, r.second.type);
+    for(auto& v : r.second.vals)
+      writeJsonSample(jw, [&] {
+        for(auto& l : v.first) {
+          jw.key(l.first);
+          jw.value(l.second);
+        }
+      }, v.second.tstampmsec, v.second.value);
+    writeJsonFamilyEnd(jw);
+  }
+  jw.endObject();
+}
+
+void writeJsonFamilyStart(JsonWriter& jw, std::string_view name, std::string_view help, std::string_view type)
+{
+  jw.key(name);
+  jw.startObject();
+  jw.key("help");
+  jw.value(help);
+  jw.key("type");
+  jw.value(type);
+  jw.key("values");
+  jw.startArray();
+}
+
+void writeJsonFamilyEnd(JsonWriter& jw)
+{
+  jw.endArray();
+  jw.endObject();
+}
+
+void writeNdjson(JsonWriter& jw, const PromParser::PromSample& s)
+{
+  jw.startObject();
+  jw.key("name");
+  jw.value(s.name);
+  jw.key("labels");
+  jw.startObject();
+  for(auto& l : s.labels) {
+    jw.key(l.first);
+    jw.value(l.second);
+  }
+  jw.endObject();
+  jw.key("value");
+  jw.value(s.value);
+  jw.key("timestamp");
+  jw.value(s.tstampmsec);
+  if(s.help) {
+    jw.key("help");
+    jw.value(*s.help);
+    jw.key("type");
+    jw.value(*s.type);
+  }
+  jw.endObject();
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include "promparser.hh"
+#include "jsonwriter.hh"
+
+// the nested document prom2json has always produced
+void writeJson(JsonWriter& jw, const PromParser::promparseres_t& result);
+// a single sample as one object, for newline delimited JSON
+void writeNdjson(JsonWriter& jw, const PromParser::PromSample& s);
+
+// the pieces writeJson is made of, for results that are not a promparseres_t:
+// between startObject() and endObject() of the document, each family is
+// writeJsonFamilyStart, a writeJsonSample per series, then writeJsonFamilyEnd
+void writeJsonFamilyStart(JsonWriter& jw, std::string_view name, std::string_view help, std::string_view type);
+void writeJsonFamilyEnd(JsonWriter& jw);
+
+// writeLabels() emits the key/value pairs inside the "labels" object
+template<typename F>
+void writeJsonSample(JsonWriter& jw, F&& writeLabels, int64_t tstampmsec, double value)
+{
+  jw.startObject();
+  jw.key("labels");
+  jw.startObject();
+  writeLabels();
+  jw.endObject();
+  jw.key("timestamp");
+  jw.value(tstampmsec);
+  jw.key("value");
+  jw.value(value);
+  jw.endObject();
+}
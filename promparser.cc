@@ -1,10 +1,163 @@
 #include "promparser.hh"
 #include "peglib.h"
+#include "allocstats.hh"
+#include "staleness.hh"
 #include <fmt/ranges.h>
+#include <atomic>
+#include <charconv>
+#include <cstring>
+#include <deque>
+#include <set>
+#include <thread>
 using namespace std;
+
+// the logger has no per-parse state, so errors go to a per-thread string
+static thread_local string t_error;
+
+// passed to the actions as 'dt'
+struct ParseState
+{
+  const PromParser::sample_cb_t* cb = nullptr; // nullptr when building a promparseres_t
+  const MetricFilter* filter = nullptr;         // nullptr if all names are wanted
+  const Relabeler* relabel = nullptr;           // nullptr if there are no rules
+  const PromParser::Limits* limits = nullptr;
+  PromParser::pmrparseres_t* pmr = nullptr;    // built directly by the actions if set
+  PromParser::promparseres_t* into = nullptr;  // updated directly by the actions if set
+  // into or pmr: vline and commentline read their own text, so the rules
+  // below them build no strings and a known series costs nothing. The result
+  // is all that allocates, besides the regexes of relabeling
+  bool views = false;
+  PromParser::labelviews_t labelViews; // of the current line, filled by nvpair
+  deque<string> unescaped;             // label values with escapes, reused
+  size_t unescapedUsed = 0;
+  RelabelScratch relabelScratch;       // what the rules rewrite, in views mode
+  SeriesRegistry* registry = nullptr;          // told about every sample in callback mode if set
+  PromParser::ParseStats stats;
+  map<string, pair<string, string>> meta; // help and type per name, in callback mode
+  size_t samples = 0;
+  set<string, less<>> families; // only filled if there is a family limit
+};
+
+static const char* limitName(PromParser::LimitError::Kind kind)
+{
+  using K = PromParser::LimitError::Kind;
+  switch(kind) {
+  case K::Samples: return "Sample";
+  case K::Labels: return "Label pairs per series";
+  case K::LabelValueLength: return "Label value length";
+  case K::Bytes: return "Input size";
+  case K::Families: return "Metric family";
+  }
+  return "Unknown";
+}
+
+PromParser::LimitError::LimitError(Kind kind_, size_t limit, size_t line_) :
+  std::runtime_error(line_ ? fmt::format("{} limit of {} exceeded on line {}", limitName(kind_), limit, line_) :
+                     fmt::format("{} limit of {} exceeded", limitName(kind_), limit)),
+  kind(kind_), line(line_)
+{}
+
+// throws if 'count' is over 'limit', vs tells where we are in the input
+static void checkLimit(size_t limit, size_t count, PromParser::LimitError::Kind kind, const peg::SemanticValues& vs)
+{
+  if(limit && count > limit)
+    throw PromParser::LimitError(kind, limit, peg::line_info(vs.ss, vs.sv().data()).first);
+}
+
+// HELP and TYPE of series that were all dropped or renamed by relabeling
+template<typename M>
+static void eraseEmptyFamilies(M& res)
+{
+  for(auto iter = res.begin(); iter != res.end(); ) {
+    if(iter->second.vals.empty())
+      iter = res.erase(iter);
+    else
+      ++iter;
+  }
+}
+
+static PromParser::PmrEntry& pmrFamily(PromParser::pmrparseres_t& res, std::string_view name)
+{
+  if(auto iter = res.find(name); iter != res.end())
+    return iter->second;
+  return res.emplace(name, PromParser::PmrEntry()).first->second;
+}
+
+static bool viewsMode(std::any& dt)
+{
+  auto st = std::any_cast<ParseState*>(&dt);
+  return st && (*st)->views;
+}
+
+// the sample and family limits, counted once a sample is certain to be kept
+static void checkSampleLimits(ParseState& st, std::string_view name, const peg::SemanticValues& vs)
+{
+  if(!st.limits)
+    return;
+  checkLimit(st.limits->maxSamples, ++st.samples, PromParser::LimitError::Kind::Samples, vs);
+  if(st.limits->maxFamilies && !st.families.count(name)) {
+    st.families.emplace(name);
+    checkLimit(st.limits->maxFamilies, st.families.size(), PromParser::LimitError::Kind::Families, vs);
+  }
+}
+
+template<typename A, typename B>
+static bool labelsLess(const A& a, const B& b)
+{
+  return std::lexicographical_compare(a.begin(), a.end(), b.begin(), b.end(), [](const auto& x, const auto& y) {
+    int c = string_view(x.first).compare(y.first);
+    return c < 0 || (!c && string_view(x.second) < string_view(y.second));
+  });
+}
+
+bool PromParser::LabelsLess::operator()(const labels_t& a, const labelviews_t& b) const
+{
+  return labelsLess(a, b);
+}
+
+bool PromParser::LabelsLess::operator()(const labelviews_t& a, const labels_t& b) const
+{
+  return labelsLess(a, b);
+}
+
+static PromParser::PromEntry& intoFamily(PromParser::promparseres_t& res, std::string_view name)
+{
+  if(auto iter = res.find(name); iter != res.end())
+    return iter->second;
+  return res.emplace(name, PromParser::PromEntry()).first->second;
+}
+
+static const PromParser::Limits* getLimits(std::any& dt)
+{
+  auto st = std::any_cast<ParseState*>(&dt);
+  return st ? (*st)->limits : nullptr;
+}
+
+// A line whose metric name the filter rejects is consumed here, up to the
+// newline, before the grammar gets to labels or values. The same goes for
+// HELP and TYPE of such a metric. Fails for all other lines
+static size_t filteredLine(const char* s, size_t n, peg::SemanticValues&, std::any& dt)
+{
+  auto st = std::any_cast<ParseState*>(&dt);
+  if(!st || !(*st)->filter)
+    return static_cast<size_t>(-1);
+  size_t start = 0;
+  if(n > 7 && (!memcmp(s, "# HELP ", 7) || !memcmp(s, "# TYPE ", 7)))
+    start = 7;
+  size_t len = start;
+  while(len < n && (isalnum((unsigned char)s[len]) || s[len] == '_')) // same as 'name'
+    len++;
+  if(len == start || (*st)->filter->accepts(string_view(s + start, len - start)))
+    return static_cast<size_t>(-1);
+  auto nl = (const char*)memchr(s + len, '\n', n - len);
+  if(!start)
+    (*st)->stats.skipped++;
+  return nl ? nl - s : n;
+}
   
 PromParser::PromParser()
 {
+  AllocPhaseScope phase(AllocPhase::GrammarLoad);
   d_p = std::make_unique<peg::parser>();
   auto& p = *d_p; // saves bit of typing
 
@@ -13,7 +166,7 @@ PromParser::PromParser()
   }); // gets us some helpful errors if the grammar is wrong
   
   auto ok = d_p->load_grammar(R"(
-root          <- ( ( commentline / vline ) '\n')+
+root          <- ( ( filteredline / commentline / vline ) '\n')+
 commentline   <- ('# HELP ' name ' ' comment) /
                  ('# TYPE ' name ' ' comment) /
                  ('#' comment)
@@ -28,15 +181,15 @@ char          <- ('\\' . ) /
                  (!'\\' .)
 value         <- '+Inf' / '-Inf' / 'NaN' / [0-9.+e-]+ 
 timestamp     <- [+-]?[0-9]*
-)" );
+)", {{"filteredline", peg::usr(filteredLine)}});
 
   if(!ok) 
     throw runtime_error("Error in grammar\n");
 
   // this creates an attractive error messsage in case of a problem, and stores it
   // so we can throw a useful exception later if parsing fails
-  d_p->set_logger([this](size_t line, size_t col, const string& msg) {
-    d_error = fmt::format("Error on line {}:{} -> {}", line, col, msg);
+  d_p->set_logger([](size_t line, size_t col, const string& msg) {
+    t_error = fmt::format("Error on line {}:{} -> {}", line, col, msg);
   });
 
   // This contains a comment line, where choice 0 is "HELP", choice 1 is "TYPE"
@@ -48,7 +201,28 @@ timestamp     <- [+-]?[0-9]*
     string comment;
   };
   // here we parse a comment line, and return a CommentLine
-  p["commentline"] = [](const peg::SemanticValues &vs) {
+  // in callback mode, HELP and TYPE are remembered for the samples that follow
+  p["commentline"] = [](const peg::SemanticValues &vs, std::any& dt) -> std::any {
+    if(viewsMode(dt)) {
+      if(vs.choice() < 2) {
+        auto line = vs.sv().substr(7); // after '# HELP ' or '# TYPE '
+        auto space = line.find(' ');
+        auto& st = **std::any_cast<ParseState*>(&dt);
+        if(st.into) {
+          auto& e = intoFamily(*st.into, line.substr(0, space));
+          (vs.choice() == 0 ? e.help : e.type).assign(line.substr(space + 1)); // keeps capacity
+        }
+        else {
+          auto& e = pmrFamily(*st.pmr, line.substr(0, space));
+          (vs.choice() == 0 ? e.help : e.type).assign(line.substr(space + 1));
+        }
+      }
+      return std::any();
+    }
+    if(auto st = std::any_cast<ParseState*>(&dt); st && (*st)->cb && vs.choice() < 2) {
+      auto& m = (*st)->meta[std::any_cast<string>(vs[0])];
+      (vs.choice() == 0 ? m.first : m.second) = std::any_cast<string>(vs[1]);
+    }
     if(vs.choice() == 0) 
       return CommentLine({vs.choice(), std::any_cast<string>(vs[0]), std::any_cast<string>(vs[1])});
     else if(vs.choice() == 1) 
@@ -58,11 +232,15 @@ timestamp     <- [+-]?[0-9]*
   };
 
   // this merely returns the comment contents as a string
-  p["comment"] = [](const peg::SemanticValues &vs) {
-     return vs.token_to_string();
+  p["comment"] = [](const peg::SemanticValues &vs, std::any& dt) -> std::any {
+    if(viewsMode(dt))
+      return std::any();
+    return vs.token_to_string();
   };
   // and similar for the 'name' rule
-  p["name"] = [](const peg::SemanticValues &vs) {
+  p["name"] = [](const peg::SemanticValues &vs, std::any& dt) -> std::any {
+    if(viewsMode(dt))
+      return std::any();
     return vs.token_to_string();
   };
   // this is where deal with the un-escaping, using the choice()
@@ -79,7 +257,11 @@ timestamp     <- [+-]?[0-9]*
     return res.at(0);
   };
   // here we assemble all the "char"'s from above into a label_value string
-  p["label_value"] = [](const peg::SemanticValues &vs) {
+  p["label_value"] = [](const peg::SemanticValues &vs, std::any& dt) -> std::any {
+    if(auto lim = getLimits(dt))
+      checkLimit(lim->maxLabelValueLength, vs.size(), LimitError::Kind::LabelValueLength, vs);
+    if(viewsMode(dt))
+      return std::any();
     string ret;
     for(const auto& v : vs)
       ret.append(1, std::any_cast<char>(v));
@@ -90,11 +272,38 @@ timestamp     <- [+-]?[0-9]*
     return vs.token_to_number<int64_t>();
   };
   // combines a label key="value" pair into a std::pair<string,string>
-  p["nvpair"] = [](const peg::SemanticValues &vs) {
+  // in views mode the pair goes to labelViews instead, as name="value" from
+  // the input. Only values with escapes get copied, unescaped
+  p["nvpair"] = [](const peg::SemanticValues &vs, std::any& dt) -> std::any {
+    if(viewsMode(dt)) {
+      auto& st = **std::any_cast<ParseState*>(&dt);
+      auto text = vs.sv();
+      auto eq = text.find('=');
+      auto value = text.substr(eq + 2, text.size() - eq - 3);
+      if(value.find('\\') != string_view::npos) {
+        if(st.unescapedUsed == st.unescaped.size())
+          st.unescaped.emplace_back();
+        auto& buf = st.unescaped[st.unescapedUsed++];
+        buf.clear();
+        for(size_t pos = 0; pos < value.size(); ++pos) {
+          if(value[pos] == '\\' && ++pos < value.size()) // the char rule checked the escape
+            buf += value[pos] == 'n' ? '\n' : value[pos];
+          else
+            buf += value[pos];
+        }
+        value = buf;
+      }
+      st.labelViews.emplace_back(text.substr(0, eq), value);
+      return std::any();
+    }
     return std::make_pair(std::any_cast<string>(vs[0]), std::any_cast<string>(vs[1]));
   };
   // gathers all these pairs into a map<string,string>
-  p["labels"] = [](const peg::SemanticValues &vs) {
+  p["labels"] = [](const peg::SemanticValues &vs, std::any& dt) -> std::any {
+    if(auto lim = getLimits(dt))
+      checkLimit(lim->maxLabels, vs.size(), LimitError::Kind::Labels, vs);
+    if(viewsMode(dt))
+      return std::any();
     map<string,string> m;
     for(const auto& sel : vs) {
       const auto p = std::any_cast<pair<string,string>>(sel);
@@ -110,7 +319,13 @@ timestamp     <- [+-]?[0-9]*
       return -numeric_limits<double>::infinity();
     else if(vs.choice() == 2 )  // NaN
       return numeric_limits<double>::quiet_NaN();
-    
+
+    // token_to_number goes through an istringstream, which allocates. It
+    // stays as the fallback for what from_chars does not take, like "+1"
+    double ret;
+    auto tok = vs.token();
+    if(auto [ptr, ec] = std::from_chars(tok.data(), tok.data() + tok.size(), ret); ec == std::errc() && ptr == tok.data() + tok.size())
+      return ret;
     return vs.token_to_number<double>();
   };
   // this reflects the contents of a vline
@@ -125,9 +340,51 @@ timestamp     <- [+-]?[0-9]*
   /* Deals with the two choices, a line witout/without labels
   vline         <- (name ' ' value (' ' timestamp)?)  /
                    (name labels ' ' value (' ' timestamp)?) 
+     In callback mode the line is handed out right away and not kept
   */
   
-  p["vline"] = [](const peg::SemanticValues &vs) {
+  p["vline"] = [](const peg::SemanticValues &vs, std::any& dt) -> std::any {
+    if(viewsMode(dt)) {
+      auto& st = **std::any_cast<ParseState*>(&dt);
+      auto name = vs.sv().substr(0, vs.sv().find_first_of("{ "));
+      unsigned int pos = vs.choice() == 1 ? 2 : 1;
+      PromParser::TstampedValue tv{0, std::any_cast<double>(vs[pos++])};
+      if(pos < vs.size())
+        tv.tstampmsec = std::any_cast<int64_t>(vs[pos]);
+      // like labels_t: sorted by name, the first of duplicate names wins.
+      // Insertion sort, as exposition labels are few and usually sorted
+      auto& lv = st.labelViews;
+      for(size_t n = 1; n < lv.size(); ++n)
+        for(size_t m = n; m && lv[m].first < lv[m - 1].first; --m)
+          std::swap(lv[m], lv[m - 1]);
+      lv.erase(std::unique(lv.begin(), lv.end(), [](const auto& a, const auto& b) { return a.first == b.first; }), lv.end());
+      if(st.relabel && !st.relabel->apply(name, lv, st.relabelScratch)) {
+        st.stats.dropped++;
+        lv.clear();
+        st.unescapedUsed = 0;
+        return std::any();
+      }
+      checkSampleLimits(st, name, vs);
+
+      if(st.into) {
+        auto& e = intoFamily(*st.into, name);
+        if(auto iter = e.vals.find(lv); iter != e.vals.end())
+          iter->second = tv;
+        else
+          e.vals.emplace(labels_t(lv.begin(), lv.end()), tv);
+      }
+      else {
+        // the labels go straight into the resource, a repeated series wastes them
+        auto& e = pmrFamily(*st.pmr, name);
+        std::pmr::map<std::pmr::string, std::pmr::string> labels(e.vals.get_allocator());
+        for(const auto& [k, v] : lv)
+          labels.emplace(k, v);
+        e.vals[std::move(labels)] = tv;
+      }
+      lv.clear();
+      st.unescapedUsed = 0;
+      return std::any();
+    }
     VlineDetails d;
     unsigned int pos = 0;
     d.name = std::any_cast<string>(vs[pos++]);
@@ -140,12 +397,30 @@ timestamp     <- [+-]?[0-9]*
     if(pos < vs.size()) {
       d.tstampmsec = std::any_cast<int64_t>(vs[pos++]);
     }
+    auto st = std::any_cast<ParseState*>(&dt);
+    if(st && (*st)->relabel && !(*st)->relabel->apply(d.name, d.labels)) {
+      (*st)->stats.dropped++;
+      return std::any();
+    }
+    if(st)
+      checkSampleLimits(**st, d.name, vs);
+    if(st && (*st)->cb) {
+      if((*st)->registry)
+        (*st)->registry->see(d.name, d.labels);
+      PromSample s{d.name, d.labels, d.value, d.tstampmsec, nullptr, nullptr};
+      if(auto iter = (*st)->meta.find(d.name); iter != (*st)->meta.end()) {
+        s.help = &iter->second.first;
+        s.type = &iter->second.second;
+      }
+      (*(*st)->cb)(s);
+      return std::any();
+    }
     return d;
   };
   // this is the first rule, and the one that ::parse will return
   // root consists of an array of VlineDetails and CommentLines
   // which we join together in the promparseres_t map
-  p["root"] = [](const peg::SemanticValues &vs)  {
+  p["root"] = [](const peg::SemanticValues &vs, std::any& dt)  {
     promparseres_t ret;
     for(const auto& v : vs) {
       if(auto dptr = std::any_cast<VlineDetails>(&v)) {
@@ -159,15 +434,184 @@ timestamp     <- [+-]?[0-9]*
 	// ignore random comments (choice == 2)
       }
     }
+    if(auto st = std::any_cast<ParseState*>(&dt); st && (*st)->relabel)
+      eraseEmptyFamilies(ret);
     return ret; 
   };
 }
 
-PromParser::promparseres_t PromParser::parse(const std::string& in)
+// so allocation accounting can tell our actions from the peg machinery
+void PromParser::enableAllocPhases()
 {
+  if(d_allocPhases)
+    return;
+  d_allocPhases = true;
+  auto& p = *d_p;
+  for(auto& g : p.get_grammar()) {
+    auto& rule = p[g.first.c_str()];
+    if(!rule.action)
+      continue;
+    auto action = std::make_shared<peg::Action>(std::move(rule.action));
+    AllocPhase ap = g.first == "root" ? AllocPhase::ResultBuild : AllocPhase::Actions;
+    rule.action = [action, ap](peg::SemanticValues& vs, std::any& dt) {
+      AllocPhaseScope phase(ap);
+      return (*action)(vs, dt);
+    };
+  }
+}
+
+void PromParser::initState(ParseState& state, std::string_view in) const
+{
+  if(!d_filter.empty())
+    state.filter = &d_filter;
+  if(!d_relabel.empty())
+    state.relabel = &d_relabel;
+  if(d_limits.maxSamples || d_limits.maxLabels || d_limits.maxLabelValueLength || d_limits.maxFamilies)
+    state.limits = &d_limits;
+  if(d_limits.maxBytes && in.size() > d_limits.maxBytes)
+    throw LimitError(LimitError::Kind::Bytes, d_limits.maxBytes, 0);
+}
+
+PromParser::promparseres_t PromParser::parse(std::string_view in, ParseStats* stats) const
+{
+  AllocPhaseScope phase(AllocPhase::Parse);
   PromParser::promparseres_t ret;
-  if(!d_p->parse(in, ret))
-    throw runtime_error("Unable to parse prometheus input: "+d_error);
+  ParseState state;
+  initState(state, in);
+  std::any dt = &state;
+  if(!d_p->parse(in, dt, ret))
+    throw runtime_error("Unable to parse prometheus input: "+t_error);
+  if(stats)
+    *stats = state.stats;
+  return ret;
+}
+
+PromParser::pmrparseres_t PromParser::parse(std::string_view in, std::pmr::memory_resource* mr, ParseStats* stats) const
+{
+  AllocPhaseScope phase(AllocPhase::Parse);
+  pmrparseres_t ret(mr);
+  ParseState state;
+  state.pmr = &ret;
+  initState(state, in);
+  state.views = true;
+  std::any dt = &state;
+  if(!d_p->parse(in, dt))
+    throw runtime_error("Unable to parse prometheus input: "+t_error);
+  if(state.relabel)
+    eraseEmptyFamilies(ret);
+  if(stats)
+    *stats = state.stats;
+  return ret;
+}
+
+// marks series that parseInto() has not seen (yet), no sample can have this timestamp
+static constexpr int64_t s_unseen = std::numeric_limits<int64_t>::min();
+
+void PromParser::parseInto(std::string_view in, promparseres_t& res, std::vector<StaleSeries>* stale, ParseStats* stats) const
+{
+  AllocPhaseScope phase(AllocPhase::Parse);
+  ParseState state;
+  state.into = &res;
+  initState(state, in); // before touching res, this can throw the Bytes limit
+  state.views = true;
+  // clear() keeps the capacity, HELP and TYPE lines assign them again
+  for(auto& [name, entry] : res) {
+    entry.help.clear();
+    entry.type.clear();
+    for(auto& v : entry.vals)
+      v.second.tstampmsec = s_unseen;
+  }
+  std::any dt = &state;
+  if(!d_p->parse(in, dt))
+    throw runtime_error("Unable to parse prometheus input: "+t_error);
+
+  for(auto fiter = res.begin(); fiter != res.end(); ) {
+    auto& vals = fiter->second.vals;
+    for(auto iter = vals.begin(); iter != vals.end(); ) {
+      if(iter->second.tstampmsec != s_unseen) {
+        ++iter;
+        continue;
+      }
+      auto next = std::next(iter);
+      auto node = vals.extract(iter);
+      if(stale)
+        stale->push_back({fiter->first, std::move(node.key())});
+      iter = next;
+    }
+    // a family without samples stays only if it had HELP or TYPE, like with parse()
+    if(vals.empty() && (state.relabel || (fiter->second.help.empty() && fiter->second.type.empty())))
+      fiter = res.erase(fiter);
+    else
+      ++fiter;
+  }
+  if(stats)
+    *stats = state.stats;
+}
+
+void PromParser::parse(std::string_view in, const sample_cb_t& cb, ParseStats* stats) const
+{
+  AllocPhaseScope phase(AllocPhase::Parse);
+  ParseState state;
+  state.cb = &cb;
+  initState(state, in);
+  std::any dt = &state;
+  if(!d_p->parse(in, dt))
+    throw runtime_error("Unable to parse prometheus input: "+t_error);
+  if(stats)
+    *stats = state.stats;
+}
+
+void PromParser::parse(std::string_view in, SeriesRegistry& registry, const sample_cb_t& cb, ParseStats* stats) const
+{
+  AllocPhaseScope phase(AllocPhase::Parse);
+  ParseState state;
+  state.cb = &cb;
+  state.registry = &registry;
+  initState(state, in);
+  registry.beginScrape();
+  std::any dt = &state;
+  if(!d_p->parse(in, dt))
+    throw runtime_error("Unable to parse prometheus input: "+t_error);
+
+  // no timestamp, the marker belongs at the time of this scrape
+  for(const auto& series : registry.endScrape()) {
+    PromSample s{series.name, series.labels, staleNaN(), 0, nullptr, nullptr};
+    if(auto iter = state.meta.find(series.name); iter != state.meta.end()) {
+      s.help = &iter->second.first;
+      s.type = &iter->second.second;
+    }
+    cb(s);
+  }
+  if(stats)
+    *stats = state.stats;
+}
+
+std::vector<PromParser::BatchResult> PromParser::parseBatch(const std::vector<std::string_view>& ins, unsigned int threads) const
+{
+  std::vector<BatchResult> ret(ins.size());
+  if(!threads)
+    threads = std::max(1U, std::thread::hardware_concurrency());
+  threads = std::min<size_t>(threads, ins.size());
+
+  // workers grab the next unparsed input, so uneven sizes balance out
+  std::atomic<size_t> next = 0;
+  auto worker = [&]() {
+    for(size_t n = next++; n < ins.size(); n = next++) {
+      try {
+        ret[n].result = parse(ins[n]);
+      }
+      catch(std::exception& e) {
+        ret[n].error = e.what();
+      }
+    }
+  };
+
+  std::vector<std::thread> workers;
+  for(unsigned int n = 1; n < threads; ++n)
+    workers.emplace_back(worker);
+  worker(); // the calling thread does its share
+  for(auto& w : workers)
+    w.join();
   return ret;
 }
 
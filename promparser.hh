@@ -1,12 +1,21 @@
 #pragma once
+#include "metricfilter.hh"
+#include "relabel.hh"
 #include <cstdint>
+#include <functional>
 #include <string>
 #include <memory>
 #include <map>
+#include <memory_resource>
+#include <stdexcept>
+#include <string_view>
+#include <vector>
 
 namespace peg {
   struct parser;
 }
+struct ParseState;
+class SeriesRegistry;
 
 class PromParser
 {
@@ -19,18 +28,139 @@ public:
     double value;
   };
   
+  typedef std::map<std::string, std::string> labels_t;
+  typedef relabelviews_t labelviews_t; // sorted by name
+  // orders label sets like labels_t's operator<, and also against labelviews_t,
+  // so a series can be found without building its labels_t first
+  struct LabelsLess
+  {
+    using is_transparent = void;
+    bool operator()(const labels_t& a, const labels_t& b) const { return a < b; }
+    bool operator()(const labels_t& a, const labelviews_t& b) const;
+    bool operator()(const labelviews_t& a, const labels_t& b) const;
+  };
+
   struct PromEntry
   {
     std::string help;
     std::string type;
-    std::map<std::map<std::string,std::string>, TstampedValue> vals;
+    std::map<labels_t, TstampedValue, LabelsLess> vals;
   };
 
+  // PromEntry with all its strings and maps in one memory_resource
+  struct PmrEntry
+  {
+    using allocator_type = std::pmr::polymorphic_allocator<char>;
+    explicit PmrEntry(const allocator_type& alloc = {}) : help(alloc), type(alloc), vals(alloc) {}
+    PmrEntry(const PmrEntry& rhs, const allocator_type& alloc) :
+      help(rhs.help, alloc), type(rhs.type, alloc), vals(rhs.vals, alloc) {}
+    PmrEntry(PmrEntry&& rhs, const allocator_type& alloc) :
+      help(std::move(rhs.help), alloc), type(std::move(rhs.type), alloc), vals(std::move(rhs.vals), alloc) {}
+
+    std::pmr::string help;
+    std::pmr::string type;
+    std::pmr::map<std::pmr::map<std::pmr::string, std::pmr::string>, TstampedValue> vals;
+  };
+  typedef std::pmr::map<std::pmr::string, PmrEntry, std::less<>> pmrparseres_t;
+
+  struct ParseStats
+  {
+    size_t skipped = 0; // samples rejected by the filter
+    size_t dropped = 0; // samples dropped by relabeling
+  };
+
+  // 0 means unlimited. Samples and families are counted after filtering and
+  // relabeling, label pairs as they appear in the input
+  struct Limits
+  {
+    size_t maxSamples = 0;
+    size_t maxLabels = 0;           // label pairs per series
+    size_t maxLabelValueLength = 0;
+    size_t maxBytes = 0;            // size of the whole input
+    size_t maxFamilies = 0;         // distinct metric names
+  };
+  // thrown as soon as a limit is exceeded, which aborts the parse right there
+  struct LimitError : std::runtime_error
+  {
+    enum class Kind { Samples, Labels, LabelValueLength, Bytes, Families };
+    LimitError(Kind kind, size_t limit, size_t line);
+    Kind kind;
+    size_t line; // 0 for Bytes, which is checked before parsing starts
+  };
+  void setLimits(const Limits& limits) { d_limits = limits; }
+
+  typedef std::map<std::string, PromEntry, std::less<>> promparseres_t;
+  // safe to call from several threads at once on the same PromParser
+  promparseres_t parse(std::string_view in, ParseStats* stats=nullptr) const;
+  struct StaleSeries
+  {
+    std::string name;
+    std::map<std::string, std::string> labels;
+  };
+  // updates res to what parse(in) would return, reusing its nodes and strings
+  // for families and series that are still there. Series that are gone are
+  // removed, and appended to stale if it is set. Lines are matched on views of
+  // the input, relabeling included, so a known series allocates nothing beyond
+  // what its rules' regexes do.
+  // If this throws, res is valid but its contents are unspecified, except for
+  // the Bytes LimitError, which leaves res alone
+  void parseInto(std::string_view in, promparseres_t& res, std::vector<StaleSeries>* stale=nullptr, ParseStats* stats=nullptr) const;
+
+  // the same, but the result allocates from mr. With a monotonic_buffer_resource
+  // building it is pointer bumping and tearing it down is mr->release().
+  // The actions work on views of the input like parseInto, relabeling
+  // included, leaving peglib's fixed setup and the rules' regexes on the
+  // global heap
+  pmrparseres_t parse(std::string_view in, std::pmr::memory_resource* mr, ParseStats* stats=nullptr) const;
+
+  struct PromSample
+  {
+    const std::string& name;
+    const std::map<std::string,std::string>& labels;
+    double value;
+    int64_t tstampmsec;
+    const std::string* help; // nullptr if no HELP or TYPE line came before
+    const std::string* type;
+  };
+  typedef std::function<void(const PromSample&)> sample_cb_t;
+  // calls cb for every sample as soon as its line is parsed, nothing is
+  // accumulated. If parsing fails halfway, cb has seen the lines before the error
+  void parse(std::string_view in, const sample_cb_t& cb, ParseStats* stats=nullptr) const;
+  // the same for one scrape of a target. Afterwards cb gets a sample with the
+  // stale NaN (see staleness.hh) and no timestamp for every series registry
+  // had from the previous scrape that is not there anymore. If parsing fails,
+  // no markers are sent and the series seen so far count as present
+  void parse(std::string_view in, SeriesRegistry& registry, const sample_cb_t& cb, ParseStats* stats=nullptr) const;
+
+  // samples of rejected metrics are skipped right after their name, without
+  // looking at the rest of the line. Set this before parsing, not during
+  void setFilter(MetricFilter filter) { d_filter = std::move(filter); }
+  // runs on every sample that passes the filter, before it is stored or handed
+  // to the callback. Families that lose all their samples are left out
+  void setRelabeler(Relabeler relabeler) { d_relabel = std::move(relabeler); }
+
+  struct BatchResult
+  {
+    promparseres_t result;
+    std::string error; // empty if parsing succeeded
+  };
+  // parses all inputs with one shared grammar on 'threads' workers (0 means
+  // one per core), results are in input order
+  std::vector<BatchResult> parseBatch(const std::vector<std::string_view>& ins, unsigned int threads=0) const;
   
-  typedef std::map<std::string, PromEntry> promparseres_t;
-  promparseres_t parse(const std::string& in);
-  
+  // for instrumentation like RuleProfiler, not for changing the grammar
+  peg::parser& pegParser() { return *d_p; }
+  // charges allocations in the grammar actions to AllocPhase::Actions, and
+  // those of the root rule to ResultBuild, instead of all to Parse. Wraps
+  // every action, so only for programs that account allocations (allocstats.hh).
+  // Call before parsing, not during
+  void enableAllocPhases();
+
 private:
+  void initState(ParseState& state, std::string_view in) const;
   std::unique_ptr<peg::parser> d_p;
-  std::string d_error;
+  MetricFilter d_filter;
+  Relabeler d_relabel;
+  Limits d_limits;
+  bool d_allocPhases = false;
 };
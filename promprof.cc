@@ -0,0 +1,52 @@
+#include "promparser.hh"
+#include "mappedfile.hh"
+#include "jsonwriter.hh"
+#include "pegtrace.hh"
+#include <fmt/core.h>
+using namespace std;
+
+// profiles the PromParser grammar on an input
+// run as ./promprof [--json|--csv|--folded|--folded-calls|--heatmap] prometheus.txt [runs]
+// the --folded formats are for flamegraph.pl, --heatmap shows re-parsing
+
+int main(int argc, char** argv)
+{
+  string format = "json";
+  int argn = 1;
+  if(argn < argc && argv[argn][0] == '-' && argv[argn][1] == '-')
+    format = argv[argn++] + 2;
+  if(argn >= argc || (format != "json" && format != "csv" && format != "folded" && format != "folded-calls" && format != "heatmap")) {
+    fmt::print(stderr, "Run as: ./promprof [--json|--csv|--folded|--folded-calls|--heatmap] prometheus.txt [runs]\n");
+    return EXIT_FAILURE;
+  }
+  MappedFile mf(argv[argn]);
+  int runs = argn + 1 < argc ? atoi(argv[argn + 1]) : 1;
+
+  PromParser pp;
+  RuleProfiler prof;
+  FoldedStackTracer folded(format == "folded" ? FoldedStackTracer::Weight::Nsec : FoldedStackTracer::Weight::Calls);
+  ParseHeatmap heatmap;
+  if(format.substr(0, 6) == "folded")
+    folded.attach(pp.pegParser());
+  else if(format == "heatmap")
+    heatmap.attach(pp.pegParser());
+  else
+    prof.attach(pp.pegParser());
+  for(int run = 0; run < runs; ++run)
+    pp.parse(mf.view(), [](const PromParser::PromSample&) {});
+
+  BufferedWriter out(1);
+  if(format.substr(0, 6) == "folded")
+    folded.write(out);
+  else if(format == "csv")
+    prof.writeCsv(out);
+  else {
+    JsonWriter jw(out, 2);
+    if(format == "heatmap")
+      heatmap.writeJson(jw);
+    else
+      prof.writeJson(jw);
+    out.append('\n');
+  }
+  out.flush();
+}
@@ -0,0 +1,458 @@
+#include "promql.hh"
+#include "promtsdb.hh"
+#include "peglib.h"
+#include <fmt/core.h>
+#include <cmath>
+using namespace std;
+
+typedef PromQL::Expr Expr;
+typedef shared_ptr<Expr> ExprP;
+
+static thread_local string t_error;
+
+// the value of an expression at every step of a query. Series that have no
+// value at a step are marked absent there, which a NaN could not express
+struct PromQL::Matrix
+{
+  struct Series
+  {
+    map<string, string> labels;
+    vector<double> values;  // one per step
+    vector<char> present;
+  };
+  bool isScalar = false;
+  vector<double> scalar; // one per step
+  vector<Series> series;
+};
+
+PromQL::PromQL()
+{
+  d_p = std::make_unique<peg::parser>();
+  auto& p = *d_p;
+
+  p.set_logger([](size_t line, size_t col, const string& msg, const string &rule) {
+    fmt::print("line {}, col {}: {}\n", line, col, msg, rule);
+  });
+
+  auto ok = p.load_grammar(R"(
+Expr          <- Atom (BinOp Atom)* {
+                   precedence
+                     L + -
+                     L * /
+                 }
+Atom          <- Aggregation / Function / Number / Selector / '(' Expr ')'
+Aggregation   <- AggOp Grouping? '(' Expr ')' Grouping?
+AggOp         <- < 'sum' / 'avg' / 'min' / 'max' / 'count' >
+Grouping      <- 'by' '(' (LabelName (',' LabelName)*)? ')'
+Function      <- FuncName '(' Expr ')'
+FuncName      <- < 'rate' / 'increase' >
+Selector      <- (MetricName LabelMatchers? Range?) /
+                 (LabelMatchers Range?)
+MetricName    <- < [a-zA-Z_:][a-zA-Z0-9_:]* >
+LabelName     <- < [a-zA-Z_][a-zA-Z0-9_]* >
+LabelMatchers <- '{' (Matcher (',' Matcher)* ','?)? '}'
+Matcher       <- LabelName MatchOp String
+MatchOp       <- < '=~' / '!~' / '!=' / '=' >
+String        <- '"' < (('\\' .) / (!'"' .))* > '"'
+Range         <- '[' Duration ']'
+Duration      <- < ([0-9]+ ('ms' / [smhdwy]))+ >
+Number        <- < [-+]? [0-9]+ ('.' [0-9]+)? ([eE] [-+]? [0-9]+)? >
+BinOp         <- < [-+*/] >
+%whitespace   <- [ \t\r\n]*
+%word         <- [a-zA-Z0-9_:]+
+)");
+  if(!ok)
+    throw runtime_error("Error in PromQL grammar\n");
+
+  p.set_logger([](size_t line, size_t col, const string& msg) {
+    t_error = fmt::format("Error on line {}:{} -> {}", line, col, msg);
+  });
+
+  auto tok = [](const peg::SemanticValues& vs) { return vs.token_to_string(); };
+  p["AggOp"] = tok;
+  p["FuncName"] = tok;
+  p["MetricName"] = tok;
+  p["LabelName"] = tok;
+  p["MatchOp"] = tok;
+  p["BinOp"] = tok;
+
+  p["String"] = [](const peg::SemanticValues& vs) {
+    string ret;
+    auto in = vs.token();
+    for(size_t n = 0; n < in.size(); ++n) {
+      if(in[n] == '\\' && n + 1 < in.size()) {
+        char c = in[++n];
+        ret += c == 'n' ? '\n' : c == 't' ? '\t' : c;
+      }
+      else
+        ret += in[n];
+    }
+    return ret;
+  };
+
+  p["Number"] = [](const peg::SemanticValues& vs) {
+    auto e = make_shared<Expr>();
+    e->kind = Expr::Kind::Number;
+    e->number = vs.token_to_number<double>();
+    return e;
+  };
+
+  p["Duration"] = [](const peg::SemanticValues& vs) {
+    static const map<string, int64_t> units{{"ms", 1}, {"s", 1000}, {"m", 60000}, {"h", 3600000},
+                                            {"d", 86400000}, {"w", 7 * 86400000LL}, {"y", 365 * 86400000LL}};
+    int64_t ret = 0;
+    auto in = vs.token();
+    for(size_t pos = 0; pos < in.size();) {
+      int64_t num = 0;
+      while(isdigit(in[pos]))
+        num = num * 10 + (in[pos++] - '0');
+      size_t len = in.substr(pos, 2) == "ms" ? 2 : 1;
+      ret += num * units.at(string(in.substr(pos, len)));
+      pos += len;
+    }
+    return ret;
+  };
+
+  p["Matcher"] = [](const peg::SemanticValues& vs) {
+    static const map<string, LabelMatcher::Type> types{{"=", LabelMatcher::Type::Equal}, {"!=", LabelMatcher::Type::NotEqual},
+                                                       {"=~", LabelMatcher::Type::Regex}, {"!~", LabelMatcher::Type::NotRegex}};
+    return LabelMatcher(types.at(any_cast<string>(vs[1])), any_cast<string>(vs[0]), any_cast<string>(vs[2]));
+  };
+
+  p["LabelMatchers"] = [](const peg::SemanticValues& vs) {
+    return vs.transform<LabelMatcher>();
+  };
+
+  p["Grouping"] = [](const peg::SemanticValues& vs) {
+    return vs.transform<string>();
+  };
+
+  // the parts are optional, so we go by their type
+  p["Selector"] = [](const peg::SemanticValues& vs) {
+    auto e = make_shared<Expr>();
+    e->kind = Expr::Kind::Selector;
+    for(const auto& v : vs) {
+      if(auto name = any_cast<string>(&v))
+        e->matchers.emplace_back(LabelMatcher::Type::Equal, "__name__", *name);
+      else if(auto ms = any_cast<vector<LabelMatcher>>(&v))
+        e->matchers.insert(e->matchers.end(), ms->begin(), ms->end());
+      else
+        e->rangeMsec = any_cast<int64_t>(v);
+    }
+    return e;
+  };
+
+  p["Function"] = [](const peg::SemanticValues& vs) {
+    auto e = make_shared<Expr>();
+    e->kind = Expr::Kind::Function;
+    e->op = any_cast<string>(vs[0]);
+    e->lhs = any_cast<ExprP>(vs[1]);
+    return e;
+  };
+
+  // sum by (a) (expr) and sum (expr) by (a) are both valid
+  p["Aggregation"] = [](const peg::SemanticValues& vs) {
+    auto e = make_shared<Expr>();
+    e->kind = Expr::Kind::Aggregation;
+    e->op = any_cast<string>(vs[0]);
+    for(size_t n = 1; n < vs.size(); ++n) {
+      if(auto g = any_cast<vector<string>>(&vs[n]))
+        e->grouping = *g;
+      else
+        e->lhs = any_cast<ExprP>(vs[n]);
+    }
+    return e;
+  };
+
+  // with the precedence instruction this gets called for every operator
+  p["Expr"] = [](const peg::SemanticValues& vs) {
+    if(vs.size() == 1)
+      return any_cast<ExprP>(vs[0]);
+    auto e = make_shared<Expr>();
+    e->kind = Expr::Kind::Binary;
+    e->lhs = any_cast<ExprP>(vs[0]);
+    e->op = any_cast<string>(vs[1]);
+    e->rhs = any_cast<ExprP>(vs[2]);
+    return e;
+  };
+}
+
+PromQL::~PromQL(){}
+
+// range vectors are only allowed where a function wants them
+static void validate(const Expr& e, bool wantRange)
+{
+  if(wantRange && e.kind != Expr::Kind::Selector)
+    throw runtime_error("Expected a range vector");
+  switch(e.kind) {
+  case Expr::Kind::Selector:
+    if(wantRange != (e.rangeMsec > 0))
+      throw runtime_error(wantRange ? "Expected a range vector" : "Range vector where an instant vector was expected");
+    if(e.matchers.empty())
+      throw runtime_error("Selector without matchers");
+    break;
+  case Expr::Kind::Function:
+    validate(*e.lhs, true);
+    break;
+  case Expr::Kind::Aggregation:
+    validate(*e.lhs, false);
+    break;
+  case Expr::Kind::Binary:
+    validate(*e.lhs, false);
+    validate(*e.rhs, false);
+    break;
+  case Expr::Kind::Number:
+    break;
+  }
+}
+
+std::shared_ptr<const PromQL::Expr> PromQL::parse(std::string_view query) const
+{
+  ExprP ret;
+  if(!d_p->parse(query, ret))
+    throw runtime_error("Unable to parse PromQL: "+t_error);
+  validate(*ret, false);
+  return ret;
+}
+
+static map<string, string> withoutName(map<string, string> labels)
+{
+  labels.erase("__name__");
+  return labels;
+}
+
+// like Prometheus, the increase is extrapolated to the edges of the window
+// when the first and last samples are close enough to them. 'result' is the
+// increase between the first and last sample, counter resets accounted for
+static double extrapolatedIncrease(double result, int64_t firstT, double firstV, int64_t lastT, size_t count,
+                                   int64_t start, int64_t end, bool isRate)
+{
+  double durationToStart = (firstT - start) / 1000.0;
+  double durationToEnd = (end - lastT) / 1000.0;
+  double sampled = (lastT - firstT) / 1000.0;
+  double avgStep = sampled / (count - 1);
+
+  if(result > 0 && firstV >= 0) {
+    double durationToZero = sampled * (firstV / result);
+    durationToStart = min(durationToStart, durationToZero);
+  }
+  double threshold = avgStep * 1.1;
+  double interval = sampled;
+  interval += durationToStart < threshold ? durationToStart : avgStep / 2;
+  interval += durationToEnd < threshold ? durationToEnd : avgStep / 2;
+  double out = result * (interval / sampled);
+  if(isRate)
+    out /= (end - start) / 1000.0;
+  return out;
+}
+
+static double applyOp(const string& op, double a, double b)
+{
+  switch(op[0]) {
+  case '+': return a + b;
+  case '-': return a - b;
+  case '*': return a * b;
+  default: return a / b;
+  }
+}
+
+// all samples of a series with mint <= t <= maxt
+static void decodeSeries(const PromHead& head, uint32_t id, int64_t mint, int64_t maxt, vector<pair<int64_t, double>>& out)
+{
+  out.clear();
+  PromHead::RangeIterator it(head, id, mint, maxt);
+  while(it.next())
+    out.emplace_back(it.t(), it.v());
+}
+
+PromQL::Matrix PromQL::evalMatrix(const Expr& e, const PromHead& head, const std::vector<int64_t>& steps) const
+{
+  Matrix ret;
+  size_t nsteps = steps.size();
+  vector<pair<int64_t, double>> samples;
+  switch(e.kind) {
+  case Expr::Kind::Number:
+    ret.isScalar = true;
+    ret.scalar.assign(nsteps, e.number);
+    break;
+
+  case Expr::Kind::Selector:
+    for(auto id : head.select(e.matchers)) {
+      decodeSeries(head, id, steps.front() - lookbackMsec + 1, steps.back(), samples);
+      Matrix::Series s{{}, vector<double>(nsteps), vector<char>(nsteps)};
+      bool any = false;
+      size_t pos = 0; // samples before pos are at or before the current step
+      for(size_t n = 0; n < nsteps; ++n) {
+        while(pos < samples.size() && samples[pos].first <= steps[n])
+          pos++;
+        if(pos && samples[pos - 1].first > steps[n] - lookbackMsec) {
+          s.values[n] = samples[pos - 1].second;
+          s.present[n] = any = true;
+        }
+      }
+      if(any) {
+        s.labels = head.labels(id);
+        s.labels["__name__"] = head.name(id);
+        ret.series.push_back(std::move(s));
+      }
+    }
+    break;
+
+  case Expr::Kind::Function: {
+    const auto& sel = *e.lhs;
+    bool isRate = e.op == "rate";
+    vector<double> increase; // up to each sample, with counter resets
+    for(auto id : head.select(sel.matchers)) {
+      decodeSeries(head, id, steps.front() - sel.rangeMsec + 1, steps.back(), samples);
+      increase.resize(samples.size());
+      for(size_t n = 0; n < samples.size(); ++n) {
+        double delta = n ? samples[n].second - samples[n-1].second : 0;
+        increase[n] = (n ? increase[n-1] : 0) + (delta < 0 ? samples[n].second : delta);
+      }
+      Matrix::Series s{{}, vector<double>(nsteps), vector<char>(nsteps)};
+      bool any = false;
+      size_t lo = 0, hi = 0; // the window of a step is [lo, hi)
+      for(size_t n = 0; n < nsteps; ++n) {
+        int64_t start = steps[n] - sel.rangeMsec;
+        while(hi < samples.size() && samples[hi].first <= steps[n])
+          hi++;
+        while(lo < hi && samples[lo].first <= start)
+          lo++;
+        if(hi - lo < 2)
+          continue;
+        s.values[n] = extrapolatedIncrease(increase[hi-1] - increase[lo], samples[lo].first, samples[lo].second,
+                                           samples[hi-1].first, hi - lo, start, steps[n], isRate);
+        s.present[n] = any = true;
+      }
+      if(any) {
+        s.labels = head.labels(id);
+        ret.series.push_back(std::move(s));
+      }
+    }
+    break;
+  }
+
+  case Expr::Kind::Aggregation: {
+    auto in = evalMatrix(*e.lhs, head, steps);
+    if(in.isScalar)
+      throw runtime_error("Aggregation over a scalar");
+    struct Acc { double sum = 0, min = INFINITY, max = -INFINITY; size_t count = 0; };
+    map<map<string, string>, vector<Acc>> groups;
+    for(const auto& s : in.series) {
+      map<string, string> key;
+      for(const auto& g : e.grouping)
+        if(auto iter = s.labels.find(g); iter != s.labels.end())
+          key.insert(*iter);
+      auto& accs = groups[key];
+      accs.resize(nsteps);
+      for(size_t n = 0; n < nsteps; ++n) {
+        if(!s.present[n])
+          continue;
+        auto& a = accs[n];
+        a.sum += s.values[n];
+        a.min = min(a.min, s.values[n]);
+        a.max = max(a.max, s.values[n]);
+        a.count++;
+      }
+    }
+    for(auto& [key, accs] : groups) {
+      Matrix::Series s{key, vector<double>(nsteps), vector<char>(nsteps)};
+      for(size_t n = 0; n < nsteps; ++n) {
+        const auto& a = accs[n];
+        if(!a.count)
+          continue;
+        s.values[n] = e.op == "sum" ? a.sum : e.op == "avg" ? a.sum / a.count :
+          e.op == "min" ? a.min : e.op == "max" ? a.max : a.count;
+        s.present[n] = true;
+      }
+      ret.series.push_back(std::move(s));
+    }
+    break;
+  }
+
+  case Expr::Kind::Binary: {
+    auto l = evalMatrix(*e.lhs, head, steps);
+    auto r = evalMatrix(*e.rhs, head, steps);
+    if(l.isScalar && r.isScalar) {
+      ret.isScalar = true;
+      ret.scalar.resize(nsteps);
+      for(size_t n = 0; n < nsteps; ++n)
+        ret.scalar[n] = applyOp(e.op, l.scalar[n], r.scalar[n]);
+    }
+    else if(l.isScalar || r.isScalar) {
+      auto& series = l.isScalar ? r.series : l.series;
+      for(auto& s : series) {
+        for(size_t n = 0; n < nsteps; ++n)
+          if(s.present[n])
+            s.values[n] = l.isScalar ? applyOp(e.op, l.scalar[n], s.values[n]) : applyOp(e.op, s.values[n], r.scalar[n]);
+        s.labels = withoutName(std::move(s.labels));
+        ret.series.push_back(std::move(s));
+      }
+    }
+    else {
+      // one-to-one matching on all labels except the name. Several right
+      // hand series can share a key, at each step the first present one counts
+      map<map<string, string>, vector<const Matrix::Series*>> rhs;
+      for(auto& s : r.series) {
+        s.labels = withoutName(std::move(s.labels));
+        rhs[s.labels].push_back(&s);
+      }
+      for(auto& s : l.series) {
+        auto key = withoutName(std::move(s.labels));
+        auto iter = rhs.find(key);
+        if(iter == rhs.end())
+          continue;
+        Matrix::Series out{std::move(key), vector<double>(nsteps), vector<char>(nsteps)};
+        bool any = false;
+        for(size_t n = 0; n < nsteps; ++n) {
+          if(!s.present[n])
+            continue;
+          for(auto rs : iter->second) {
+            if(rs->present[n]) {
+              out.values[n] = applyOp(e.op, s.values[n], rs->values[n]);
+              out.present[n] = any = true;
+              break;
+            }
+          }
+        }
+        if(any)
+          ret.series.push_back(std::move(out));
+      }
+    }
+    break;
+  }
+  }
+  return ret;
+}
+
+PromQL::vector_t PromQL::eval(const Expr& e, const PromHead& head, int64_t t) const
+{
+  auto ret = evalRange(e, head, t, t, 1);
+  return std::move(ret.front().second);
+}
+
+std::vector<std::pair<int64_t, PromQL::vector_t>> PromQL::evalRange(const Expr& e, const PromHead& head,
+                                                                  int64_t start, int64_t end, int64_t step) const
+{
+  if(step <= 0)
+    throw runtime_error("Step must be positive");
+  vector<int64_t> steps;
+  for(int64_t t = start; t <= end; t += step)
+    steps.push_back(t);
+  std::vector<std::pair<int64_t, vector_t>> ret;
+  if(steps.empty())
+    return ret;
+
+  auto m = evalMatrix(e, head, steps);
+  ret.reserve(steps.size());
+  for(size_t n = 0; n < steps.size(); ++n) {
+    vector_t vec;
+    if(m.isScalar)
+      vec.push_back({{}, m.scalar[n]});
+    for(const auto& s : m.series)
+      if(s.present[n])
+        vec.push_back({s.labels, s.values[n]});
+    ret.emplace_back(steps[n], std::move(vec));
+  }
+  return ret;
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include "postings.hh"
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace peg {
+  struct parser;
+}
+class PromHead;
+
+/* A subset of PromQL, evaluated against a PromHead:
+
+   selectors      metric{label="x", other!="y", re=~"a.*", nre!~"b.*"}
+   range vectors  metric[5m], only as argument of rate() or increase()
+   functions      rate(), increase()
+   aggregations   sum, avg, min, max, count, with optional by (...)
+   binary         + - * / between scalars and vectors, vectors on equal labels */
+
+class PromQL
+{
+public:
+  struct Expr
+  {
+    enum class Kind { Number, Selector, Function, Aggregation, Binary };
+    Kind kind;
+    double number = 0;
+    std::vector<LabelMatcher> matchers;
+    int64_t rangeMsec = 0;               // 0 for an instant selector
+    std::string op;                      // function, aggregation or operator
+    std::vector<std::string> grouping;   // by (...)
+    std::shared_ptr<Expr> lhs, rhs;      // lhs is the argument of functions and aggregations
+  };
+
+  struct Sample
+  {
+    std::map<std::string, std::string> labels; // __name__ is set for plain selectors
+    double value;
+  };
+  typedef std::vector<Sample> vector_t;
+
+  PromQL();
+  ~PromQL();
+  std::shared_ptr<const Expr> parse(std::string_view query) const;
+
+  // a scalar result comes back as one sample without labels
+  vector_t eval(const Expr& e, const PromHead& head, int64_t t) const;
+  // evaluates all steps at once: every selected series is decoded a single
+  // time for the whole range, and windows slide over those samples
+  std::vector<std::pair<int64_t, vector_t>> evalRange(const Expr& e, const PromHead& head,
+                                                      int64_t start, int64_t end, int64_t step) const;
+
+  int64_t lookbackMsec = 5 * 60 * 1000;
+
+private:
+  struct Matrix;
+  Matrix evalMatrix(const Expr& e, const PromHead& head, const std::vector<int64_t>& steps) const;
+
+  std::unique_ptr<peg::parser> d_p;
+};
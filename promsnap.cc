@@ -0,0 +1,134 @@
+#include "promsnap.hh"
+#include <cstring>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+static const uint32_t c_version = 1;
+static const uint32_t c_byteOrder = 0x01020304;
+
+namespace {
+struct StringTable
+{
+  uint32_t id(std::string_view s)
+  {
+    auto [iter, inserted] = ids.emplace(s, strs.size());
+    if(inserted)
+      strs.push_back(s);
+    return iter->second;
+  }
+  unordered_map<string_view, uint32_t> ids;
+  vector<string_view> strs;
+};
+}
+
+template<typename T>
+static uint64_t appendSection(std::string& out, const T* data, size_t count)
+{
+  out.append((8 - out.size() % 8) % 8, '\0');
+  uint64_t pos = out.size();
+  out.append((const char*)data, count * sizeof(T));
+  return pos;
+}
+
+std::string makePromSnapshot(const PromParser::promparseres_t& res)
+{
+  StringTable st;
+  vector<PromSnapFamily> families;
+  vector<uint32_t> series{0};
+  vector<PromSnapLabel> labels;
+  vector<double> values;
+  vector<int64_t> timestamps;
+
+  for(const auto& [name, entry] : res) {
+    families.push_back({st.id(name), st.id(entry.help), st.id(entry.type),
+                        (uint32_t)values.size(), (uint32_t)entry.vals.size()});
+    for(const auto& [lmap, tv] : entry.vals) {
+      for(const auto& [lname, lvalue] : lmap)
+        labels.push_back({st.id(lname), st.id(lvalue)});
+      series.push_back(labels.size());
+      values.push_back(tv.value);
+      timestamps.push_back(tv.tstampmsec);
+    }
+  }
+
+  vector<uint32_t> strOffsets{0};
+  string strData;
+  for(auto s : st.strs) {
+    strData.append(s);
+    strOffsets.push_back(strData.size());
+  }
+
+  PromSnapHeader hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, "PROMSNAP", 8);
+  hdr.version = c_version;
+  hdr.byteOrder = c_byteOrder;
+  hdr.nstrings = st.strs.size();
+  hdr.nfamilies = families.size();
+  hdr.nseries = values.size();
+  hdr.nlabels = labels.size();
+
+  string out((const char*)&hdr, sizeof(hdr));
+  hdr.strOffsets = appendSection(out, strOffsets.data(), strOffsets.size());
+  hdr.strData = appendSection(out, strData.data(), strData.size());
+  hdr.families = appendSection(out, families.data(), families.size());
+  hdr.series = appendSection(out, series.data(), series.size());
+  hdr.labels = appendSection(out, labels.data(), labels.size());
+  hdr.values = appendSection(out, values.data(), values.size());
+  hdr.timestamps = appendSection(out, timestamps.data(), timestamps.size());
+  hdr.size = out.size();
+  memcpy(out.data(), &hdr, sizeof(hdr));
+  return out;
+}
+
+// structural checks only, the contents of a snapshot are trusted
+PromSnapView::PromSnapView(const std::string& fname) : d_mf(fname)
+{
+  auto v = d_mf.view();
+  if(v.size() < sizeof(PromSnapHeader))
+    throw runtime_error("'"+fname+"' is too short to be a snapshot");
+  d_hdr = (const PromSnapHeader*)v.data();
+  if(memcmp(d_hdr->magic, "PROMSNAP", 8))
+    throw runtime_error("'"+fname+"' is not a snapshot");
+  if(d_hdr->byteOrder != c_byteOrder)
+    throw runtime_error("'"+fname+"' was written with a different byte order");
+  if(d_hdr->version != c_version)
+    throw runtime_error("'"+fname+"' has unsupported snapshot version "+to_string(d_hdr->version));
+  if(d_hdr->size != v.size())
+    throw runtime_error("'"+fname+"' is truncated");
+
+  auto section = [&](uint64_t off, uint64_t len, size_t align) {
+    if(off % align || off > v.size() || len > v.size() - off)
+      throw runtime_error("'"+fname+"' has a corrupt section table");
+    return v.data() + off;
+  };
+  d_strOffsets = (const uint32_t*)section(d_hdr->strOffsets, (d_hdr->nstrings + 1ULL) * 4, 4);
+  d_strData = section(d_hdr->strData, d_strOffsets[d_hdr->nstrings], 1);
+  d_families = (const PromSnapFamily*)section(d_hdr->families, d_hdr->nfamilies * sizeof(PromSnapFamily), 4);
+  d_series = (const uint32_t*)section(d_hdr->series, (d_hdr->nseries + 1ULL) * 4, 4);
+  d_labels = (const PromSnapLabel*)section(d_hdr->labels, d_hdr->nlabels * sizeof(PromSnapLabel), 4);
+  d_values = (const double*)section(d_hdr->values, d_hdr->nseries * 8ULL, 8);
+  d_timestamps = (const int64_t*)section(d_hdr->timestamps, d_hdr->nseries * 8ULL, 8);
+  if(d_series[d_hdr->nseries] != d_hdr->nlabels)
+    throw runtime_error("'"+fname+"' has a corrupt series table");
+}
+
+PromParser::promparseres_t PromSnapView::toParseResult() const
+{
+  PromParser::promparseres_t ret;
+  for(uint32_t f = 0; f < numFamilies(); ++f) {
+    const auto& fam = family(f);
+    auto& entry = ret[string(str(fam.name))];
+    entry.help = str(fam.help);
+    entry.type = str(fam.type);
+    for(uint32_t s = fam.firstSeries; s < fam.firstSeries + fam.seriesCount; ++s) {
+      map<string, string> lmap;
+      for(auto l = labelsBegin(s); l != labelsEnd(s); ++l)
+        lmap.emplace(str(l->name), str(l->value));
+      entry.vals[std::move(lmap)] = {timestamp(s), value(s)};
+    }
+  }
+  return ret;
+}
@@ -0,0 +1,79 @@
+#pragma once
+#include "promparser.hh"
+#include "mappedfile.hh"
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+/* Binary snapshot of a parsed scrape, in host byte order:
+
+   header       magic "PROMSNAP", version, byte order marker, counts and
+                section offsets
+   strings      (count+1) uint32 offsets into the string bytes, deduplicated
+   families     {name, help, type} string ids, first series, series count
+   series       (count+1) uint32 offsets into the label pairs
+   labels       {name, value} string id pairs
+   values       double per series
+   timestamps   int64 per series
+
+   Families come in promparseres_t order, series in the order of their label
+   maps, so iterating a snapshot visits everything in the same order as the
+   original std::maps. */
+
+struct PromSnapHeader
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t byteOrder;
+  uint32_t nstrings, nfamilies, nseries, nlabels;
+  uint64_t strOffsets, strData, families, series, labels, values, timestamps;
+  uint64_t size;
+};
+
+struct PromSnapFamily
+{
+  uint32_t name, help, type;
+  uint32_t firstSeries, seriesCount;
+};
+
+struct PromSnapLabel
+{
+  uint32_t name, value;
+};
+
+std::string makePromSnapshot(const PromParser::promparseres_t& res);
+
+// maps a snapshot and reads it in place, no deserialisation
+class PromSnapView
+{
+public:
+  explicit PromSnapView(const std::string& fname);
+
+  uint32_t numFamilies() const { return d_hdr->nfamilies; }
+  uint32_t numSeries() const { return d_hdr->nseries; }
+  const PromSnapFamily& family(uint32_t n) const { return d_families[n]; }
+
+  std::string_view str(uint32_t id) const
+  {
+    return std::string_view(d_strData + d_strOffsets[id], d_strOffsets[id+1] - d_strOffsets[id]);
+  }
+  // the label pairs of a series
+  const PromSnapLabel* labelsBegin(uint32_t series) const { return d_labels + d_series[series]; }
+  const PromSnapLabel* labelsEnd(uint32_t series) const { return d_labels + d_series[series+1]; }
+  double value(uint32_t series) const { return d_values[series]; }
+  int64_t timestamp(uint32_t series) const { return d_timestamps[series]; }
+
+  // builds the std::map representation, for code that needs it
+  PromParser::promparseres_t toParseResult() const;
+
+private:
+  MappedFile d_mf;
+  const PromSnapHeader* d_hdr;
+  const uint32_t* d_strOffsets;
+  const char* d_strData;
+  const PromSnapFamily* d_families;
+  const uint32_t* d_series;
+  const PromSnapLabel* d_labels;
+  const double* d_values;
+  const int64_t* d_timestamps;
+};
@@ -1,6 +1,22 @@
 #define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
 #include "doctest.h"
 #include "promparser.hh"
+#include "arenaast.hh"
+#include "jsonwriter.hh"
+#include "promsnap.hh"
+#include "promcolumns.hh"
+#include "promtsdb.hh"
+#include "promql.hh"
+#include "scrapediff.hh"
+#include "relabel.hh"
+#include "pegtrace.hh"
+#include "allocstats.hh"
+#include "expogen.hh"
+#include "staleness.hh"
+#include "histograms.hh"
+#include "peglib.h"
+#include <fmt/core.h>
+#include <unistd.h>
 
 using namespace std;
 
@@ -83,3 +99,1119 @@ apt_upgrades_held{arch="",origin=""} 0 1713712554000
   CHECK(res["apt_upgrades_held"].help == "Apt packages pëndİng updates but held back.");
 
 }
+
+TEST_CASE("arena ast matches shared_ptr ast") {
+  const char* grammar = R"(
+List    <- Item (',' Item)*
+Item    <- Pair / Number
+Pair    <- '(' Number ',' Number ')'
+Number  <- < [0-9]+ >
+%whitespace <- [ ]*
+)";
+  const string in = "1, (2, 3), 45";
+
+  peg::parser ref(grammar);
+  ref.enable_ast();
+  shared_ptr<peg::Ast> refast;
+  REQUIRE(ref.parse(in, refast));
+
+  peg::parser p(grammar);
+  ArenaAst ast;
+  ast.attach(p);
+  REQUIRE(ast.parse(p, in));
+  CHECK(ast.toString() == peg::ast_to_s(refast));
+
+  ast.optimize();
+  CHECK(ast.toString() == peg::ast_to_s(ref.optimize_ast(refast)));
+
+  const auto& root = ast[ast.root()];
+  CHECK(string(root.name) == "List");
+  REQUIRE(ast.children(ast.root()).size() == 3);
+  const auto& pair = ast[ast.children(ast.root())[1]];
+  CHECK(string(pair.name) == "Pair");
+  CHECK(string(pair.originalName) == "Item");
+  CHECK(pair.parent == ast.root());
+  CHECK(ast[ast.children(ast.root())[2]].token == "45");
+
+  int tokens = 0;
+  ast.visit([&](uint32_t idx, int) {
+    tokens += ast[idx].isToken;
+    return true;
+  });
+  CHECK(tokens == 4);
+
+  // the arena is reused
+  REQUIRE(ast.parse(p, "7"));
+  CHECK(ast.size() == 3);
+}
+
+TEST_CASE("batch parse") {
+  PromParser p;
+  vector<string> bodies;
+  for(int n = 0; n < 100; ++n)
+    bodies.push_back(n == 42 ? "bogus{\n" : "metric{n=\"" + to_string(n) + "\"} " + to_string(n) + "\n");
+  vector<string_view> ins(bodies.begin(), bodies.end());
+
+  auto res = p.parseBatch(ins, 4);
+  REQUIRE(res.size() == 100);
+  for(int n = 0; n < 100; ++n) {
+    if(n == 42) {
+      CHECK(!res[n].error.empty());
+      continue;
+    }
+    REQUIRE(res[n].error.empty());
+    map<string,string> labels{{"n", to_string(n)}};
+    CHECK(res[n].result["metric"].vals[labels].value == n);
+  }
+}
+
+TEST_CASE("json formatting") {
+  auto dbl = [](double d) {
+    string s;
+    appendJsonDouble(s, d);
+    return s;
+  };
+  CHECK(dbl(149) == "149.0");
+  CHECK(dbl(3.072603244608e+12) == "3072603244608.0");
+  CHECK(dbl(1.3045e-05) == "1.3045e-05");
+  CHECK(dbl(0.0001) == "0.0001");
+  CHECK(dbl(41.237950823) == "41.237950823");
+  CHECK(dbl(1e16) == "1e+16");
+  CHECK(dbl(-2.5e300) == "-2.5e+300");
+  CHECK(dbl(0) == "0.0");
+  CHECK(dbl(numeric_limits<double>::quiet_NaN()) == "null");
+  // Grisu2 is not always shortest, nlohmann prints these with more digits
+  CHECK(dbl(7.566e+21) == "7.566000000000001e+21");
+  CHECK(dbl(2.292e+22) == "2.2919999999999998e+22");
+  CHECK(dbl(5.238e+21) == "5.238000000000001e+21");
+
+  // every value of a generated exposition, against what nlohmann 3.11.2 printed
+  ExpoGenOptions opts;
+  opts.families = 200;
+  opts.series = 50;
+  string all;
+  for(const auto& [name, e] : PromParser().parse(generateExposition(opts)))
+    for(const auto& [labels, tv] : e.vals) {
+      appendJsonDouble(all, tv.value);
+      all += '\n';
+    }
+  uint64_t h = 14695981039346656037ULL;
+  for(unsigned char c : all) {
+    h ^= c;
+    h *= 1099511628211ULL;
+  }
+  CHECK(all.size() == 120518);
+  CHECK(h == 0x3dfbcf991124182aULL);
+
+  string esc;
+  appendJsonEscaped(esc, "a\"b\\c\n\x01pëndİng");
+  CHECK(esc == "a\\\"b\\\\c\\n\\u0001pëndİng");
+}
+
+TEST_CASE("callback parse") {
+  PromParser p;
+  vector<string> seen;
+  p.parse(R"(# HELP go_goroutines Number of goroutines that currently exist.
+# TYPE go_goroutines gauge
+go_goroutines 8
+go_info{version="go1.19.8"} 1 1713712554000
+)", [&](const PromParser::PromSample& s) {
+    seen.push_back(s.name);
+    if(s.name == "go_goroutines") {
+      REQUIRE(s.type);
+      CHECK(*s.type == "gauge");
+      CHECK(s.value == 8);
+    }
+    else {
+      CHECK(!s.help);
+      CHECK(s.labels.at("version") == "go1.19.8");
+      CHECK(s.tstampmsec == 1713712554000);
+    }
+  });
+  CHECK(seen == vector<string>{"go_goroutines", "go_info"});
+}
+
+TEST_CASE("metric filter") {
+  string in = R"(# TYPE go_goroutines gauge
+go_goroutines 8
+# HELP go_gc_duration_seconds A summary of the pause duration of garbage collection cycles.
+# TYPE go_gc_duration_seconds summary
+go_gc_duration_seconds{quantile="0.5"} 0.001
+node_cpu_seconds_total{cpu="0",mode="idle"} 1234.5
+node_load1 0.25
+node_network_receive_bytes_total{device="eth0"} 42
+)";
+  MetricFilter f;
+  f.allowPrefix("node_");
+  f.allow("go_goroutines");
+  f.denyRegex("node_network_.*");
+  CHECK(f.accepts("node_load1"));
+  CHECK(!f.accepts("node_network_receive_bytes_total"));
+  CHECK(!f.accepts("go_gc_duration_seconds"));
+
+  PromParser p;
+  p.setFilter(f);
+  PromParser::ParseStats stats;
+  auto res = p.parse(in, &stats);
+  CHECK(res.size() == 3);
+  CHECK(res.count("go_goroutines"));
+  CHECK(res.count("node_cpu_seconds_total"));
+  CHECK(res.count("node_load1"));
+  CHECK(stats.skipped == 2); // HELP and TYPE lines do not count
+
+  vector<string> seen;
+  p.parse(in, [&](const PromParser::PromSample& s) { seen.push_back(s.name); }, &stats);
+  CHECK(seen == vector<string>{"go_goroutines", "node_cpu_seconds_total", "node_load1"});
+  CHECK(stats.skipped == 2);
+
+  // rejected lines are not looked at beyond the name
+  CHECK(p.parse("go_gc_duration_seconds{broken 1\nnode_load1 1\n").size() == 1);
+  CHECK_THROWS(p.parse("node_load1{broken 1\n"));
+}
+
+// equal results, NaN values included
+static bool same(const PromParser::promparseres_t& a, const PromParser::promparseres_t& b)
+{
+  if(a.size() != b.size())
+    return false;
+  for(auto i = a.begin(), j = b.begin(); i != a.end(); ++i, ++j) {
+    if(i->first != j->first || i->second.help != j->second.help || i->second.type != j->second.type ||
+       i->second.vals.size() != j->second.vals.size())
+      return false;
+    for(auto k = i->second.vals.begin(), l = j->second.vals.begin(); k != i->second.vals.end(); ++k, ++l)
+      if(k->first != l->first || k->second.tstampmsec != l->second.tstampmsec ||
+         (k->second.value != l->second.value && !(std::isnan(k->second.value) && std::isnan(l->second.value))))
+        return false;
+  }
+  return true;
+}
+
+TEST_CASE("relabeling") {
+  using A = RelabelRule::Action;
+  vector<RelabelRule> rules(6);
+  rules[0].action = A::Drop;
+  rules[0].sourceLabels = {"__name__", "mode"};
+  rules[0].regex = "node_cpu_seconds_total;(user|system)|node_dropped_total;.*";
+  rules[1].sourceLabels = {"instance"};
+  rules[1].regex = "(.*):\\d+";
+  rules[1].targetLabel = "host";
+  rules[2].action = A::LabelMap;
+  rules[2].regex = "__meta_(.+)";
+  rules[2].replacement = "meta_${1}";
+  rules[3].action = A::LabelDrop;
+  rules[3].regex = "__meta_.*|instance";
+  rules[4].action = A::HashMod;
+  rules[4].sourceLabels = {"host"};
+  rules[4].targetLabel = "shard";
+  rules[4].modulus = 4;
+  rules[5].sourceLabels = {"__name__"};
+  rules[5].regex = "node_(.*)";
+  rules[5].targetLabel = "__name__";
+  rules[5].replacement = "host_$1";
+
+  string in = R"(# HELP node_cpu_seconds_total Seconds the CPUs spent in each mode.
+node_cpu_seconds_total{cpu="0",mode="idle",instance="a:9100"} 10
+node_cpu_seconds_total{cpu="0",mode="user",instance="a:9100"} 20
+node_cpu_seconds_total{cpu="0",mode="system",instance="a:9100"} 30
+# HELP node_dropped_total Everything of this family gets dropped
+node_dropped_total{mode="user"} 1
+go_goroutines{__meta_zone="eu",instance="b:9100"} 8
+)";
+  PromParser p;
+  p.setRelabeler(Relabeler(rules));
+  PromParser::ParseStats stats;
+  auto res = p.parse(in, &stats);
+  CHECK(stats.dropped == 3);
+  REQUIRE(res.size() == 2);
+  const auto& cpu = res.at("host_cpu_seconds_total");
+  REQUIRE(cpu.vals.size() == 1);
+  auto labels = cpu.vals.begin()->first;
+  CHECK(labels.at("host") == "a");
+  CHECK(labels.at("shard").size() == 1);
+  CHECK(!labels.count("instance"));
+  labels = res.at("go_goroutines").vals.begin()->first;
+  CHECK(labels.at("meta_zone") == "eu");
+  CHECK(!labels.count("__meta_zone"));
+  CHECK(labels.at("host") == "b");
+
+  // same shard for the same host, whatever the other labels
+  string shardA = cpu.vals.begin()->first.at("shard");
+  size_t seen = 0;
+  p.parse(R"(x{instance="a:1",job="j"} 1
+y{instance="a:1"} 2
+)", [&](const PromParser::PromSample& s) {
+    CHECK(s.labels.at("shard") == shardA);
+    seen++;
+  });
+  CHECK(seen == 2);
+
+  // parseInto and the pmr parse relabel views of the input, with the same result
+  string escaped = in + "go_threads{instance=\"c\\\"q\\\":9100\",job=\"x\"} 3\n";
+  auto ref = p.parse(escaped);
+  PromParser::promparseres_t into;
+  p.parseInto(escaped, into, nullptr, &stats);
+  CHECK(stats.dropped == 3);
+  CHECK(same(into, ref));
+  CHECK(into.at("go_threads").vals.begin()->first.at("host") == "c\"q\"");
+  std::pmr::monotonic_buffer_resource mr;
+  auto pmrRes = p.parse(escaped, &mr);
+  REQUIRE(pmrRes.size() == ref.size());
+  for(const auto& [name, entry] : ref) {
+    auto& pe = pmrRes.at(std::pmr::string(name));
+    REQUIRE(pe.vals.size() == entry.vals.size());
+    auto piter = pe.vals.begin();
+    for(const auto& [labels, val] : entry.vals) {
+      CHECK(std::equal(labels.begin(), labels.end(), piter->first.begin(), piter->first.end(), [](const auto& a, const auto& b) {
+        return a.first == string_view(b.first) && a.second == string_view(b.second);
+      }));
+      CHECK(piter->second.value == val.value);
+      ++piter;
+    }
+  }
+
+  // known series cost the regexes, not a name and label map per line
+  ExpoGenOptions opts;
+  opts.families = 10;
+  opts.series = 50;
+  string gen = generateExposition(opts);
+  vector<RelabelRule> genRules(2);
+  genRules[0].sourceLabels = {"instance"};
+  genRules[0].regex = "(.*):\\d+";
+  genRules[0].targetLabel = "host";
+  genRules[1].action = A::LabelDrop;
+  genRules[1].regex = "instance";
+  PromParser gp;
+  gp.setRelabeler(Relabeler(genRules));
+  gp.enableAllocPhases();
+  into.clear();
+  gp.parseInto(gen, into);
+  auto before = allocSnapshot();
+  gp.parseInto(gen, into);
+  auto viewsAllocs = (allocSnapshot() - before)[AllocPhase::Actions].allocs;
+  before = allocSnapshot();
+  CHECK(same(gp.parse(gen), into));
+  auto fullAllocs = (allocSnapshot() - before)[AllocPhase::Actions].allocs;
+  MESSAGE("action allocations with relabeling, parseInto " << viewsAllocs << ", parse " << fullAllocs);
+  CHECK(viewsAllocs < fullAllocs / 2);
+
+  rules.assign(1, RelabelRule());
+  rules[0].action = A::HashMod;
+  rules[0].targetLabel = "shard";
+  CHECK_THROWS(Relabeler(rules));
+
+  // replacements expand like Go's Regexp.Expand
+  auto replaced = [](const string& replacement) {
+    RelabelRule r;
+    r.sourceLabels = {"instance"};
+    r.regex = "(h)(o)(s)(t)(-)(a)(b)(c)(d)(e)";
+    r.targetLabel = "out";
+    r.replacement = replacement;
+    string name = "x";
+    map<string, string> labels{{"instance", "host-abcde"}};
+    Relabeler({r}).apply(name, labels);
+    return labels.count("out") ? labels.at("out") : string("<none>");
+  };
+  CHECK(replaced("${1}0") == "h0");
+  CHECK(replaced("$10") == "e");
+  CHECK(replaced("$1$2_") == "h"); // $2_ is a named group, which is empty
+  CHECK(replaced("${2}_$$1") == "o_$1");
+  CHECK(replaced("$ and ${x-y}") == "$ and ${x-y}");
+  CHECK(replaced("$name") == "<none>");
+  CHECK_THROWS(replaced("${1"));
+}
+
+TEST_CASE("parse limits") {
+  string in;
+  for(int n = 0; n < 50000; ++n)
+    in += fmt::format("metric_{}{{instance=\"host{}:9100\",job=\"node\"}} {}\n", n % 100, n, n);
+
+  PromParser p;
+  PromParser::Limits limits;
+  limits.maxSamples = 1000;
+  p.setLimits(limits);
+  CHECK_THROWS_AS(p.parse(in), PromParser::LimitError); // one-off allocations of a first throw
+  resetAllocPeak();
+  size_t base = allocSnapshot().live;
+  try {
+    p.parse(in);
+    FAIL("no limit error");
+  }
+  catch(PromParser::LimitError& e) {
+    CHECK(e.kind == PromParser::LimitError::Kind::Samples);
+    CHECK(e.line == 1001);
+    CHECK(string(e.what()) == "Sample limit of 1000 exceeded on line 1001");
+  }
+  CHECK(allocSnapshot().live == base); // everything freed on the way out
+  size_t limitedPeak = allocSnapshot().peak - base;
+  CHECK(limitedPeak < 2000000);
+
+  p.setLimits({});
+  resetAllocPeak();
+  CHECK(p.parse(in).size() == 100);
+  size_t peak = allocSnapshot().peak - base;
+  MESSAGE("peak with limit " << limitedPeak << ", without " << peak);
+  CHECK(peak > 10 * limitedPeak);
+
+  auto expect = [&](const PromParser::Limits& l, const string& in, PromParser::LimitError::Kind kind, size_t line) {
+    p.setLimits(l);
+    try {
+      p.parse(in, [](const PromParser::PromSample&) {});
+      FAIL("no limit error");
+    }
+    catch(PromParser::LimitError& e) {
+      CHECK(e.kind == kind);
+      CHECK(e.line == line);
+    }
+  };
+  using K = PromParser::LimitError::Kind;
+  PromParser::Limits l;
+  l.maxLabels = 2;
+  expect(l, "a{x=\"1\",y=\"2\"} 1\nb{x=\"1\",y=\"2\",z=\"3\"} 1\n", K::Labels, 2);
+  l = {};
+  l.maxLabelValueLength = 3;
+  expect(l, "a{x=\"123\"} 1\na{x=\"1234\"} 1\n", K::LabelValueLength, 2);
+  l = {};
+  l.maxFamilies = 2;
+  expect(l, "a 1\nb 1\na{x=\"y\"} 1\nc 1\n", K::Families, 4);
+  l = {};
+  l.maxBytes = 10;
+  expect(l, "a 1\nb 1\nc 1\n", K::Bytes, 0);
+}
+
+// what f writes to a BufferedWriter, which only knows file descriptors
+template<typename F>
+static string captured(F f)
+{
+  FILE* fp = tmpfile();
+  REQUIRE(fp);
+  {
+    BufferedWriter out(fileno(fp));
+    f(out);
+    out.flush();
+  }
+  string ret(ftell(fp), '\0');
+  rewind(fp);
+  REQUIRE(fread(ret.data(), 1, ret.size(), fp) == ret.size());
+  fclose(fp);
+  return ret;
+}
+
+TEST_CASE("rule profiler") {
+  PromParser p;
+  RuleProfiler prof;
+  prof.attach(p.pegParser());
+  string in = "# TYPE a counter\na{x=\"1\"} 1\nb 2\n";
+  for(int n = 0; n < 2; ++n)
+    p.parse(in);
+  CHECK(prof.parses() == 2);
+
+  map<string, RuleProfiler::Rule> rules;
+  for(const auto& r : prof.rules())
+    if(r.calls)
+      rules[r.name] = r;
+  CHECK(rules.at("root").calls == 2);
+  CHECK(rules.at("root").bytesConsumed == 2 * in.size());
+  CHECK(rules.at("vline").successes == 4);
+  CHECK(rules.at("labels").successes == 2);
+  // the first vline alternative matched name 'a' before failing on '{'
+  CHECK(rules.at("vline").bytesBacktracked == 2);
+  for(const auto& [name, r] : rules) {
+    CHECK(r.calls == r.successes + r.failures);
+    CHECK(r.exclusiveNsec <= r.inclusiveNsec);
+  }
+  CHECK(rules.at("root").inclusiveNsec <= prof.totalNsec());
+
+  string csv = captured([&](BufferedWriter& out) { prof.writeCsv(out); });
+  CHECK(csv.find("rule,calls,successes,failures,inclusive_nsec") == 0);
+  CHECK(csv.find("\nroot,2,2,0,") != string::npos);
+
+  prof.reset();
+  CHECK(prof.parses() == 0);
+  CHECK(prof.rules().empty());
+}
+
+TEST_CASE("folded stacks") {
+  PromParser p;
+  string in = "# TYPE a counter\na{x=\"1\"} 1\nb 2\n";
+  FoldedStackTracer calls(FoldedStackTracer::Weight::Calls);
+  calls.attach(p.pegParser());
+  p.parse(in);
+  string folded = captured([&](BufferedWriter& out) { calls.write(out); });
+  CHECK(folded.find("root 1\n") == 0);
+  CHECK(folded.find("\nroot;vline;labels;nvpair;label_value 1\n") != string::npos);
+  // both vline alternatives parse the name of a, and try one at the end
+  CHECK(folded.find("\nroot;vline;name 5\n") != string::npos);
+  CHECK(calls.truncated() == 0);
+
+  FoldedStackTracer small(FoldedStackTracer::Weight::Nsec, 3);
+  small.attach(p.pegParser());
+  for(int n = 0; n < 3; ++n)
+    p.parse(in);
+  CHECK(small.nodes() == 3);
+  CHECK(small.truncated() > 0);
+  folded = captured([&](BufferedWriter& out) { small.write(out); });
+  size_t lines = 0;
+  for(size_t pos = 0; (pos = folded.find('\n', pos)) != string::npos; ++pos)
+    lines++;
+  CHECK(lines <= 3);
+}
+
+TEST_CASE("parse heatmap") {
+  PromParser p;
+  ParseHeatmap heat(2, 5, 1); // rules per offset
+  heat.attach(p.pegParser());
+  string in = "# TYPE a counter\na{x=\"1\"} 1\nb 2\n";
+  p.parse(in);
+  CHECK(heat.inputSize() == in.size());
+  CHECK(heat.entries().size() == in.size() + 1);
+  CHECK(heat.amplification() > 1);
+
+  map<string, ParseHeatmap::Rule> rules;
+  for(const auto& r : heat.rules())
+    if(r.entries)
+      rules[r.name] = r;
+  // the name of a by both vline alternatives, and at the end of the input
+  CHECK(rules.at("name").reentries == 2);
+  CHECK(rules.at("vline").reentries == 0);
+
+  // line 2 and the end: filteredline, commentline, vline, name twice
+  REQUIRE(heat.hotspots().size() == 2);
+  CHECK(heat.hotspots()[0].line == 2);
+  CHECK(heat.hotspots()[0].column == 1);
+  CHECK(heat.hotspots()[0].entries == 5);
+  const auto& hot = heat.hotspots()[0].rules;
+  REQUIRE(hot.size() == 4);
+  CHECK(heat.rules().at(hot[0].rule).name == "name");
+  CHECK(hot[0].entries == 2);
+  CHECK(heat.rules().at(hot[1].rule).name == "commentline");
+  CHECK(hot[1].entries == 1);
+  CHECK(heat.entries(hot[0].rule, heat.hotspots()[0].offset) == 2);
+  CHECK(heat.entries(hot[0].rule, 1) == 0);
+  CHECK(heat.hotspots()[1].offset == in.size());
+  CHECK(heat.hotspots()[1].line == 4);
+
+  // one 64 byte bucket holds all of the input, and so every start of name
+  PromParser bp;
+  ParseHeatmap bucketed(2, 5, 64);
+  bucketed.attach(bp.pegParser());
+  bp.parse(in);
+  CHECK(bucketed.hotspots()[0].offset == heat.hotspots()[0].offset);
+  CHECK(bucketed.entries(hot[0].rule, 1) == rules.at("name").entries);
+  CHECK(bucketed.rules().at(hot[0].rule).reentries == 2);
+
+  // a second parse starts over
+  p.parse("b 2\n");
+  CHECK(heat.inputSize() == 4);
+  CHECK(heat.rules().at(0).entries == 1);
+}
+
+TEST_CASE("allocation budget") {
+  auto before = allocSnapshot();
+  PromParser p;
+  auto load = allocSnapshot() - before;
+  CHECK(load[AllocPhase::GrammarLoad].allocs > 0);
+  CHECK(load.total().allocs == load[AllocPhase::GrammarLoad].allocs);
+
+  ExpoGenOptions opts;
+  opts.families = 20;
+  opts.series = 50;
+  string in = generateExposition(opts);
+  size_t samples = opts.families * opts.series;
+
+  // without the opt-in everything in a parse counts as Parse
+  before = allocSnapshot();
+  p.parse(in);
+  auto plain = allocSnapshot() - before;
+  CHECK(plain[AllocPhase::Actions].allocs == 0);
+  CHECK(plain[AllocPhase::ResultBuild].allocs == 0);
+  CHECK(plain.total().allocs == plain[AllocPhase::Parse].allocs);
+
+  p.enableAllocPhases();
+  p.enableAllocPhases(); // wraps only once
+  before = allocSnapshot();
+  auto res = p.parse(in);
+  auto d = allocSnapshot() - before;
+  CHECK(d[AllocPhase::Other].allocs == 0);
+  CHECK(d[AllocPhase::Parse].allocs > 0);
+  CHECK(d[AllocPhase::Actions].allocs > 0);
+  CHECK(d[AllocPhase::ResultBuild].allocs > 0);
+  double perSample = double(d.total().allocs) / samples;
+  double bytesPerByte = double(d.total().bytes) / in.size();
+  MESSAGE("allocations per sample " << perSample << ", bytes allocated per input byte " << bytesPerByte);
+  // a regression guard, raise these only knowingly
+  CHECK(perSample < 40);
+  CHECK(bytesPerByte < 25);
+}
+
+TEST_CASE("pmr result") {
+  ExpoGenOptions opts;
+  opts.families = 10;
+  opts.series = 20;
+  string in = generateExposition(opts);
+  PromParser p;
+  auto ref = p.parse(in);
+
+  // everything has to come from buf, the upstream resource refuses
+  vector<char> buf(1 << 20);
+  std::pmr::monotonic_buffer_resource mr(buf.data(), buf.size(), std::pmr::null_memory_resource());
+  auto res = p.parse(in, &mr);
+  REQUIRE(res.size() == ref.size());
+  auto iter = res.begin();
+  for(const auto& [name, entry] : ref) {
+    CHECK(string_view(iter->first) == name);
+    CHECK(string_view(iter->second.help) == entry.help);
+    CHECK(string_view(iter->second.type) == entry.type);
+    REQUIRE(iter->second.vals.size() == entry.vals.size());
+    auto viter = iter->second.vals.begin();
+    for(const auto& [labels, val] : entry.vals) {
+      REQUIRE(viter->first.size() == labels.size());
+      CHECK(std::equal(labels.begin(), labels.end(), viter->first.begin(), [](const auto& a, const auto& b) {
+        return a.first == string_view(b.first) && a.second == string_view(b.second);
+      }));
+      CHECK(viter->second.tstampmsec == val.tstampmsec);
+      CHECK((viter->second.value == val.value || (std::isnan(val.value) && std::isnan(viter->second.value))));
+      ++viter;
+    }
+    CHECK(iter->second.vals.get_allocator().resource() == &mr);
+    ++iter;
+  }
+
+  // each resource gets its own buffer, res still lives in buf
+  vector<char> tinyBuf(64);
+  std::pmr::monotonic_buffer_resource tiny(tinyBuf.data(), tinyBuf.size(), std::pmr::null_memory_resource());
+  CHECK_THROWS_AS(p.parse(in, &tiny), std::bad_alloc);
+
+  // without relabel rules the actions put nothing on the global heap, what
+  // is left is peglib's setup, as with parseInto
+  vector<char> againBuf(buf.size());
+  std::pmr::monotonic_buffer_resource again(againBuf.data(), againBuf.size(), std::pmr::null_memory_resource());
+  p.enableAllocPhases();
+  auto before = allocSnapshot();
+  auto res2 = p.parse(in, &again);
+  auto heap = allocSnapshot() - before;
+  CHECK(res2.size() == ref.size());
+  MESSAGE("global allocations with a pmr result " << heap.total().allocs);
+  CHECK(heap[AllocPhase::Actions].allocs < 10);
+  CHECK(heap.total().allocs < 200);
+}
+
+TEST_CASE("parse into existing result") {
+
+  PromParser p;
+  PromParser::promparseres_t res;
+  p.parseInto(R"(# HELP a The a.
+# TYPE a counter
+a{x="1"} 1
+a{x="2"} 2
+b 3
+# HELP c Only metadata
+)", res);
+  const auto* help = res.at("a").help.data();
+  const auto* node = &res.at("a").vals.begin()->second;
+
+  string second = R"(# HELP a The a.
+# TYPE a counter
+a{x="1"} 10 1713712554000
+a{x="3"} 30
+# TYPE d gauge
+)";
+  vector<PromParser::StaleSeries> stale;
+  p.parseInto(second, res, &stale);
+  CHECK(same(res, p.parse(second)));
+  CHECK(res.at("a").help.data() == help);
+  CHECK(&res.at("a").vals.begin()->second == node);
+  CHECK(res.at("a").vals.begin()->second.value == 10);
+  REQUIRE(stale.size() == 2);
+  CHECK(stale[0].name == "a");
+  CHECK(stale[0].labels == map<string, string>{{"x", "2"}});
+  CHECK(stale[1].name == "b");
+  CHECK(!res.count("c"));
+
+  // steady state: a handful of allocations per parse in peglib's setup, none
+  // per line, whatever the number of series
+  ExpoGenOptions opts;
+  opts.families = 20;
+  opts.series = 50;
+  string in = generateExposition(opts);
+  p.enableAllocPhases();
+  res.clear();
+  p.parseInto(in, res);
+  auto before = allocSnapshot();
+  p.parseInto(in, res);
+  auto into = allocSnapshot() - before;
+  before = allocSnapshot();
+  auto fresh = p.parse(in);
+  auto full = (allocSnapshot() - before).total().allocs;
+  CHECK(same(res, fresh));
+  MESSAGE("allocations with parseInto " << into.total().allocs << ", with parse " << full);
+  CHECK(into[AllocPhase::Actions].allocs < 10);
+  CHECK(into.total().allocs < 200);
+
+  // a rejected input leaves res as it was
+  PromParser::Limits lim;
+  lim.maxBytes = 10;
+  p.setLimits(lim);
+  CHECK_THROWS_AS(p.parseInto(in, res), PromParser::LimitError);
+  CHECK(same(res, fresh));
+}
+
+TEST_CASE("staleness markers") {
+  CHECK(isStaleNaN(staleNaN()));
+  CHECK(std::isnan(staleNaN()));
+  CHECK(!isStaleNaN(std::nan("")));
+  CHECK(!isStaleNaN(1.0));
+
+  PromParser p;
+  SeriesRegistry reg;
+  vector<pair<string, double>> got;
+  auto scrape = [&](string_view in) {
+    got.clear();
+    p.parse(in, reg, [&](const PromParser::PromSample& s) {
+      string id = s.name;
+      for(const auto& [k, v] : s.labels)
+        id += "," + k + "=" + v;
+      got.push_back({id, s.value});
+    });
+  };
+
+  scrape("a{x=\"1\"} 1\na{x=\"2\"} 2\nb 3\n");
+  CHECK(got.size() == 3);
+  CHECK(reg.size() == 3);
+
+  // a{x="2"} and b are gone, each gets one marker after the samples
+  scrape("a{x=\"1\"} 10\nc NaN\n");
+  REQUIRE(got.size() == 4);
+  CHECK(got[0] == pair<string, double>{"a,x=1", 10});
+  CHECK(!isStaleNaN(got[1].second));
+  set<string> stale;
+  for(size_t n = 2; n < got.size(); ++n) {
+    CHECK(isStaleNaN(got[n].second));
+    stale.insert(got[n].first);
+  }
+  CHECK(stale == set<string>{"a,x=2", "b"});
+  CHECK(reg.size() == 2);
+
+  // unchanged, so no markers
+  scrape("a{x=\"1\"} 11\nc 4\n");
+  CHECK(got.size() == 2);
+
+  // a series that comes back is new again, and is only marked once
+  CHECK(reg.see("b", {}));
+  CHECK(!reg.see("b", {}));
+  reg.beginScrape();
+  CHECK(reg.endScrape().size() == 3);
+  CHECK(reg.endScrape().empty());
+  CHECK(reg.size() == 0);
+
+  // every series collides, the second stays known after the first is gone
+  SeriesRegistry same([](std::string_view, const map<string, string>&) { return uint64_t(42); });
+  same.beginScrape();
+  CHECK(same.see("a", {}));
+  CHECK(same.see("b", {}));
+  CHECK(same.see("c", {}));
+  same.beginScrape();
+  CHECK(!same.see("b", {}));
+  CHECK(!same.see("c", {}));
+  auto gone = same.endScrape();
+  REQUIRE(gone.size() == 1);
+  CHECK(gone[0].name == "a");
+  same.beginScrape();
+  CHECK(!same.see("b", {}));
+  CHECK(!same.see("c", {}));
+  CHECK(same.endScrape().empty());
+  CHECK(same.size() == 2);
+}
+
+TEST_CASE("histogram assembly") {
+  PromParser p;
+  auto res = p.parse(R"(# HELP req_seconds Request latency.
+# TYPE req_seconds histogram
+req_seconds_bucket{path="/",le="0.1"} 10
+req_seconds_bucket{path="/",le="+Inf"} 100
+req_seconds_bucket{path="/",le="1"} 40
+req_seconds_bucket{path="/",le="0.5"} 45
+req_seconds_sum{path="/"} 123.5
+req_seconds_count{path="/"} 100
+req_seconds_bucket{path="/x",le="1.0"} 1
+req_seconds_bucket{path="/x",le="1"} 2
+req_seconds_bucket{path="/x",le="+Inf"} 3
+other_bucket{le="1"} 1
+)");
+  auto hists = assembleHistograms(res);
+  REQUIRE(hists.size() == 1);
+  const auto& h = hists.at("req_seconds");
+  CHECK(h.kind == HistogramFamily::Kind::Histogram);
+  CHECK(h.help == "Request latency.");
+  REQUIRE(h.series.size() == 2);
+
+  const auto& s = h.series[0];
+  CHECK(s.labels == map<string, string>{{"path", "/"}});
+  REQUIRE(s.size == 4);
+  CHECK(vector<double>(h.boundsOf(s), h.boundsOf(s) + s.size) == vector<double>{0.1, 0.5, 1, INFINITY});
+  // 40 after 45 is made monotonic
+  CHECK(vector<double>(h.valuesOf(s), h.valuesOf(s) + s.size) == vector<double>{10, 45, 45, 100});
+  CHECK(s.sum == 123.5);
+  CHECK(s.count == 100);
+
+  // equal bounds are merged, a series without _sum has NaN there
+  const auto& x = h.series[1];
+  REQUIRE(x.size == 2);
+  CHECK(h.valuesOf(x)[0] == 3);
+  CHECK(std::isnan(x.sum));
+
+  CHECK(h.quantile(0.05, s) == doctest::Approx(0.05));
+  CHECK(h.quantile(0.1, s) == doctest::Approx(0.1));
+  CHECK(h.quantile(0.3, s) == doctest::Approx(0.1 + 0.4 * 20 / 35.0));
+  CHECK(h.quantile(0.9, s) == 1); // lands in +Inf
+  CHECK(h.quantile(-1, s) == -INFINITY);
+  CHECK(h.quantile(2, s) == INFINITY);
+  CHECK(std::isnan(h.quantile(NAN, s)));
+
+  double bounds[] = {1, 2};
+  double counts[] = {0, 0};
+  CHECK(std::isnan(histogramQuantile(0.5, bounds, counts, 2))); // no +Inf bucket
+
+  // the summary from prometheus.txt, its first quantile is not a number
+  auto sres = p.parse(R"(# HELP go_gc_duration_seconds A summary of the pause duration of garbage collection cycles.
+# TYPE go_gc_duration_seconds summary
+go_gc_duration_seconds{quantile="0\n1\n\"2\""} 1.3045e-05 1713712554000
+go_gc_duration_seconds{quantile="0.25"} 1.7935e-05 1713712554000
+go_gc_duration_seconds{quantile="0.5"} 2.2914e-05 1713712554000
+go_gc_duration_seconds{quantile="0.75"} 2.8947e-05 1713712554000
+go_gc_duration_seconds{quantile="1"} 5.8896e-05 1713712554000
+go_gc_duration_seconds_sum 41.237950823
+go_gc_duration_seconds_count 1.575957e+06
+)");
+  auto summaries = assembleHistograms(sres);
+  const auto& gc = summaries.at("go_gc_duration_seconds");
+  CHECK(gc.kind == HistogramFamily::Kind::Summary);
+  REQUIRE(gc.series.size() == 1);
+  const auto& g = gc.series[0];
+  CHECK(g.labels.empty());
+  CHECK(vector<double>(gc.boundsOf(g), gc.boundsOf(g) + g.size) == vector<double>{0.25, 0.5, 0.75, 1});
+  CHECK(gc.valuesOf(g)[1] == 2.2914e-05);
+  CHECK(g.sum == 41.237950823);
+  CHECK(g.count == 1.575957e+06);
+  CHECK(g.tstampmsec == 1713712554000);
+  CHECK(std::isnan(gc.quantile(0.5, g)));
+}
+
+TEST_CASE("snapshot roundtrip") {
+  PromParser p;
+  auto res = p.parse(R"(# HELP apt_upgrades_pending Apt packages pending updates by origin.
+# TYPE apt_upgrades_pending gauge
+apt_upgrades_pending{arch="all",origin="Debian:bookworm-security/stable-security"} 1
+apt_upgrades_pending{arch="amd64",origin="Debian:bookworm-security/stable-security"} 16 1713712554000
+go_goroutines 8
+)");
+  string fname = "/tmp/promtests.snap";
+  auto snap = makePromSnapshot(res);
+  FILE* fp = fopen(fname.c_str(), "w");
+  REQUIRE(fp);
+  REQUIRE(fwrite(snap.data(), 1, snap.size(), fp) == snap.size());
+  fclose(fp);
+
+  PromSnapView sv(fname);
+  REQUIRE(sv.numFamilies() == 2);
+  REQUIRE(sv.numSeries() == 3);
+  CHECK(sv.str(sv.family(0).name) == "apt_upgrades_pending");
+  CHECK(sv.str(sv.family(1).help) == "");
+  CHECK(sv.timestamp(1) == 1713712554000);
+  CHECK(sv.labelsEnd(2) == sv.labelsBegin(2));
+
+  auto back = sv.toParseResult();
+  REQUIRE(back.size() == res.size());
+  for(auto& [name, entry] : res) {
+    CHECK(back[name].help == entry.help);
+    CHECK(back[name].type == entry.type);
+    REQUIRE(back[name].vals.size() == entry.vals.size());
+    for(auto& [labels, tv] : entry.vals) {
+      CHECK(back[name].vals[labels].value == tv.value);
+      CHECK(back[name].vals[labels].tstampmsec == tv.tstampmsec);
+    }
+  }
+  unlink(fname.c_str());
+}
+
+TEST_CASE("columnar output") {
+  PromParser p;
+  PromColumns cols;
+  const char* in = R"(# TYPE apt_upgrades_pending gauge
+apt_upgrades_pending{arch="all",origin="Debian"} 1
+apt_upgrades_pending{arch="amd64",origin="Debian"} 16 1713712554000
+go_goroutines 8
+)";
+  cols.parse(p, in);
+  REQUIRE(cols.values.size() == 3);
+  CHECK(cols.values == vector<double>{1, 16, 8});
+  CHECK(cols.timestamps[1] == 1713712554000);
+  CHECK(cols.seriesRefs == vector<uint32_t>{0, 1, 2});
+  CHECK(cols.series(1).name == "apt_upgrades_pending");
+  CHECK(cols.series(1).labels.at("arch") == "amd64");
+  CHECK(cols.series(2).labels.empty());
+
+  // a second scrape reuses the refs of known series
+  cols.clear();
+  cols.parse(p, "go_goroutines 9\nnew_metric 1\n");
+  CHECK(cols.values == vector<double>{9, 1});
+  CHECK(cols.seriesRefs == vector<uint32_t>{2, 3});
+  CHECK(cols.numSeries() == 4);
+}
+
+TEST_CASE("gorilla chunk roundtrip") {
+  XorChunk c;
+  vector<pair<int64_t, double>> in{{1713712554000, 1}, {1713712569000, 1}, {1713712584000, 2.5},
+                                   {1713712599003, -3e100}, {1713712614000, numeric_limits<double>::infinity()},
+                                   {1713713614000, 0}, {1713813614000, 4}, {1813813614000, 1.3045e-05}};
+  for(auto [t, v] : in)
+    c.append(t, v);
+  c.append(1813813614001, numeric_limits<double>::quiet_NaN());
+  XorChunk::Iterator it(c);
+  for(auto [t, v] : in) {
+    REQUIRE(it.next());
+    CHECK(it.t() == t);
+    CHECK(it.v() == v);
+  }
+  REQUIRE(it.next());
+  CHECK(isnan(it.v()));
+  CHECK(!it.next());
+}
+
+TEST_CASE("head append, read and retention") {
+  PromParser p;
+  PromHead::Options opts;
+  opts.maxChunkSamples = 4;
+  PromHead head(opts);
+  int64_t t = 1713712554000;
+  for(int n = 0; n < 10; ++n) {
+    string in = "go_goroutines " + to_string(n) + "\n";
+    if(n < 5)
+      in += "go_info{version=\"go1.19.8\"} 1\n";
+    CHECK(head.ingest(p, in, t + n * 15000) == (n < 5 ? 2 : 1));
+  }
+  CHECK(head.ingest(p, "go_goroutines 99\n", t) == 0); // out of order
+  CHECK(head.numSeries() == 2);
+  CHECK(head.numSamples() == 15);
+
+  auto id = head.lookup("go_goroutines", {});
+  REQUIRE(id != PromHead::npos);
+  PromHead::RangeIterator it(head, id, t + 3 * 15000, t + 6 * 15000);
+  vector<double> vals;
+  while(it.next())
+    vals.push_back(it.v());
+  CHECK(vals == vector<double>{3, 4, 5, 6});
+
+  // go_info stopped at n=4, so all its chunks end before mint
+  head.truncate(t + 5 * 15000);
+  CHECK(head.numSeries() == 1);
+  CHECK(head.lookup("go_info", {{"version", "go1.19.8"}}) == PromHead::npos);
+  CHECK(head.numSamples() == 6);
+}
+
+TEST_CASE("postings and label selection") {
+  vector<uint32_t> a{1, 3, 5, 7, 9, 100, 1000}, b{0, 3, 4, 5, 1000, 1001};
+  CHECK(intersectPostings(a, b) == vector<uint32_t>{3, 5, 1000});
+  CHECK(intersectPostings(b, a) == vector<uint32_t>{3, 5, 1000});
+
+  Postings p;
+  for(auto id : {5, 300, 70000, 2})
+    p.add(id);
+  p.remove(300);
+  vector<uint32_t> ids;
+  p.decode(ids);
+  CHECK(ids == vector<uint32_t>{2, 5, 70000});
+
+  PromParser pp;
+  PromHead head;
+  head.ingest(pp, R"(apt_upgrades_pending{arch="all",origin="Debian"} 1
+apt_upgrades_pending{arch="amd64",origin="Debian"} 16
+apt_upgrades_pending{arch="amd64",origin="Ubuntu"} 2
+go_goroutines 8
+)", 1713712554000);
+
+  using T = LabelMatcher::Type;
+  auto names = [&](const vector<LabelMatcher>& m) {
+    vector<string> ret;
+    for(auto id : head.select(m))
+      ret.push_back(head.name(id) + (head.labels(id).empty() ? "" : "/" + head.labels(id).at("origin")));
+    return ret;
+  };
+  CHECK(names({{T::Equal, "arch", "amd64"}}) == vector<string>{"apt_upgrades_pending/Debian", "apt_upgrades_pending/Ubuntu"});
+  CHECK(names({{T::Equal, "arch", "amd64"}, {T::NotEqual, "origin", "Debian"}}) == vector<string>{"apt_upgrades_pending/Ubuntu"});
+  CHECK(names({{T::Regex, "arch", "a.*"}, {T::NotRegex, "origin", "Deb.*"}}) == vector<string>{"apt_upgrades_pending/Ubuntu"});
+  CHECK(names({{T::Equal, "arch", ""}}) == vector<string>{"go_goroutines"});
+  CHECK(names({{T::Equal, "__name__", "go_goroutines"}}) == vector<string>{"go_goroutines"});
+  CHECK(names({{T::Equal, "arch", "sparc"}}).empty());
+}
+
+TEST_CASE("postings with many removed series") {
+  PromHead::Options opts;
+  opts.maxChunkSamples = 1;
+  PromHead head(opts);
+  const uint32_t count = 20000;
+  for(uint32_t n = 0; n < count; ++n)
+    head.append("m", {{"job", "j" + to_string(n % 3)}, {"n", to_string(n)}}, n % 2 ? 2000 : 1000, n);
+  head.truncate(1500); // every even n goes
+  CHECK(head.numSeries() == count / 2);
+
+  using T = LabelMatcher::Type;
+  auto ids = head.select({{T::Equal, "job", "j0"}});
+  CHECK(ids.size() == (count / 3 + 1) / 2); // odd multiples of 3
+  CHECK(is_sorted(ids.begin(), ids.end()));
+  CHECK(all_of(ids.begin(), ids.end(), [&](uint32_t id) { return stoi(head.labels(id).at("n")) % 6 == 3; }));
+  CHECK(head.select({{T::Equal, "n", "4"}}).empty());
+
+  // new series take the freed ids, which are below the last id in every list
+  for(uint32_t n = 0; n < count / 2; ++n)
+    head.append("m", {{"job", "new"}, {"n", "x" + to_string(n)}}, 3000, n);
+  CHECK(head.numSeries() == count);
+  CHECK(head.select({{T::Equal, "job", "new"}}).size() == count / 2);
+  auto all = head.select({{T::Equal, "__name__", "m"}});
+  CHECK(all.size() == count);
+  CHECK(is_sorted(all.begin(), all.end()));
+  CHECK(adjacent_find(all.begin(), all.end()) == all.end());
+
+  head.truncate(2500);
+  CHECK(head.numSeries() == count / 2);
+  CHECK(head.select({{T::Equal, "job", "j1"}}).empty());
+  CHECK(head.select({{T::Equal, "__name__", "m"}}) == head.select({{T::Equal, "job", "new"}}));
+}
+
+TEST_CASE("promql") {
+  PromParser pp;
+  PromHead head;
+  int64_t t = 1713712554000;
+  for(int n = 0; n <= 20; ++n) {
+    // a counter that resets at n=10, and two gauges
+    string in = "http_requests_total{job=\"api\",code=\"200\"} " + to_string(n < 10 ? n * 30 : (n - 10) * 30) + "\n";
+    in += "http_requests_total{job=\"api\",code=\"500\"} " + to_string(n * 3) + "\n";
+    in += "summary_temp{job=\"api\"} " + to_string(20 + n) + "\n";
+    in += "summary_temp{job=\"db\"} 10\n";
+    head.ingest(pp, in, t + n * 15000);
+  }
+  int64_t now = t + 20 * 15000;
+
+  PromQL q;
+  auto eval = [&](const char* expr) {
+    return q.eval(*q.parse(expr), head, now);
+  };
+
+  auto r = eval("summary_temp{job=\"api\"}");
+  REQUIRE(r.size() == 1);
+  CHECK(r[0].value == 40);
+  CHECK(r[0].labels.at("__name__") == "summary_temp");
+
+  r = eval("sum(summary_temp)");
+  REQUIRE(r.size() == 1);
+  CHECK(r[0].value == 50);
+  CHECK(r[0].labels.empty());
+
+  r = eval("max by (job) (summary_temp) * 2 + 1");
+  REQUIRE(r.size() == 2);
+  CHECK(r[0].labels.at("job") == "api");
+  CHECK(r[0].value == 81);
+  CHECK(r[1].value == 21);
+
+  CHECK(eval("1 + 2 * 3")[0].value == 7);
+  CHECK(eval("(1 + 2) * 3")[0].value == 9);
+  CHECK(eval("10 - 4 - 3")[0].value == 3);
+
+  // 3 per 15 seconds, samples cover the whole window so no extrapolation is needed
+  r = eval("rate(http_requests_total{code=\"500\"}[5m])");
+  REQUIRE(r.size() == 1);
+  CHECK(r[0].value == doctest::Approx(0.2));
+  CHECK(r[0].labels.count("__name__") == 0);
+
+  // the reset at n=10 is not counted as a decrease: 240 before, 300 after,
+  // extrapolated by 15s from the 285s the samples span
+  r = eval("increase(http_requests_total{code=\"200\"}[5m])");
+  REQUIRE(r.size() == 1);
+  CHECK(r[0].value == doctest::Approx(540.0 * 300 / 285));
+
+  r = eval("sum by (job) (rate(http_requests_total[5m]))");
+  REQUIRE(r.size() == 1);
+  CHECK(r[0].value > 0.2);
+
+  r = eval("summary_temp / summary_temp");
+  REQUIRE(r.size() == 2);
+  CHECK(r[0].value == 1);
+
+  auto range = q.evalRange(*q.parse("summary_temp{job=\"api\"}"), head, now - 30000, now, 15000);
+  REQUIRE(range.size() == 3);
+  CHECK(range[0].second[0].value == 38);
+
+  // a whole range at once gives what evaluating each step on its own does,
+  // also at steps where some series have no samples yet
+  for(auto expr : {"http_requests_total", "rate(http_requests_total[1m])", "increase(http_requests_total[2m]) / 2",
+                   "sum by (code) (rate(http_requests_total[5m]))", "summary_temp - summary_temp{job=\"db\"}",
+                   "count(summary_temp) + 1", "3 * 2"}) {
+    auto e = q.parse(expr);
+    auto all = q.evalRange(*e, head, t - 60000, now + 400000, 7000);
+    REQUIRE(all.size() == 109);
+    size_t samples = 0, differ = 0;
+    for(const auto& [at, vec] : all) {
+      auto single = q.eval(*e, head, at);
+      samples += vec.size();
+      if(single.size() != vec.size()) {
+        differ++;
+        continue;
+      }
+      for(size_t n = 0; n < vec.size(); ++n)
+        if(single[n].labels != vec[n].labels || single[n].value != doctest::Approx(vec[n].value))
+          differ++;
+    }
+    INFO(expr);
+    CHECK(samples > 0);
+    CHECK(differ == 0);
+  }
+
+  CHECK_THROWS(q.parse("rate(summary_temp)"));
+  CHECK_THROWS(q.parse("summary_temp[5m]"));
+  CHECK_THROWS(q.parse("sum(("));
+  // a function needs a range selector, not something that yields an instant vector
+  CHECK_THROWS_WITH(q.parse("rate(sum(a_total))"), "Expected a range vector");
+  CHECK_THROWS_WITH(q.parse("rate(rate(a_total[1m]))"), "Expected a range vector");
+  CHECK_THROWS_WITH(q.parse("increase(a_total + 1)"), "Expected a range vector");
+  CHECK_NOTHROW(q.parse("sum(rate(a_total[1m])) + 1"));
+}
+
+TEST_CASE("counter diff") {
+  PromParser pp;
+  auto prev = pp.parse(R"(# TYPE go_memstats_alloc_bytes_total counter
+go_memstats_alloc_bytes_total 1000
+# TYPE go_goroutines gauge
+go_goroutines 8
+# TYPE rpc summary
+rpc_sum 10
+rpc_count 4
+# TYPE http_requests_total counter
+http_requests_total{code="200"} 50
+http_requests_total{code="404"} 7
+)");
+  auto cur = pp.parse(R"(# TYPE go_memstats_alloc_bytes_total counter
+go_memstats_alloc_bytes_total 4000
+# TYPE go_goroutines gauge
+go_goroutines 9
+# TYPE rpc summary
+rpc_sum 12
+rpc_count 5
+# TYPE http_requests_total counter
+http_requests_total{code="200"} 20
+http_requests_total{code="500"} 1
+)");
+  CounterScrape p(prev, 1713712554000), c(cur, 1713712569000);
+  CHECK(c.entries.size() == 5);
+  auto d = diffCounters(p, c);
+  REQUIRE(d.rows.size() == 4);
+
+  map<string, pair<double, bool>> byName;
+  for(size_t n = 0; n < d.rows.size(); ++n) {
+    const auto& e = c.entries[d.rows[n]];
+    byName[*e.name + (e.labels->empty() ? "" : e.labels->begin()->second)] = {d.rates[n], d.resets[n]};
+  }
+  CHECK(byName["go_memstats_alloc_bytes_total"].first == 200);
+  CHECK(byName["rpc_count"].first == doctest::Approx(1 / 15.0));
+  CHECK(byName["rpc_sum"].first == doctest::Approx(2 / 15.0));
+  CHECK(byName["http_requests_total200"].second);
+  CHECK(byName["http_requests_total200"].first == doctest::Approx(20 / 15.0));
+}
@@ -0,0 +1,295 @@
+#include "promtsdb.hh"
+#include "fingerprint.hh"
+#include <algorithm>
+#include <cstring>
+using namespace std;
+
+void BitStream::write(uint64_t v, int nbits)
+{
+  while(nbits > 0) {
+    int used = d_bits % 8;
+    if(!used)
+      d_bytes.push_back(0);
+    int take = std::min(8 - used, nbits);
+    uint8_t part = (v >> (nbits - take)) & ((1U << take) - 1);
+    d_bytes.back() |= part << (8 - used - take);
+    nbits -= take;
+    d_bits += take;
+  }
+}
+
+uint64_t BitStream::read(size_t& pos, int nbits) const
+{
+  uint64_t ret = 0;
+  while(nbits > 0) {
+    int used = pos % 8;
+    int take = std::min(8 - used, nbits);
+    uint8_t part = (d_bytes[pos / 8] >> (8 - used - take)) & ((1U << take) - 1);
+    ret = (ret << take) | part;
+    nbits -= take;
+    pos += take;
+  }
+  return ret;
+}
+
+// delta-of-delta buckets, in bits, as used by Prometheus for millisecond timestamps
+static const int c_dodBits[] = {14, 17, 20};
+
+static bool fitsSigned(int64_t v, int nbits)
+{
+  return v >= -(int64_t(1) << (nbits - 1)) && v < (int64_t(1) << (nbits - 1));
+}
+
+static int64_t signExtend(uint64_t v, int nbits)
+{
+  if(nbits < 64 && (v >> (nbits - 1)) & 1)
+    v |= ~uint64_t(0) << nbits;
+  return (int64_t)v;
+}
+
+static uint64_t d2u(double d)
+{
+  uint64_t u;
+  memcpy(&u, &d, sizeof(u));
+  return u;
+}
+
+void XorChunk::append(int64_t t, double v)
+{
+  uint64_t u = d2u(v);
+  if(!d_count) {
+    d_bs.write(t, 64);
+    d_bs.write(u, 64);
+    d_minTime = t;
+  }
+  else {
+    // the first delta is stored as a delta-of-delta against 0
+    int64_t delta = t - d_t;
+    int64_t dod = delta - d_delta;
+    if(!dod)
+      d_bs.write(0, 1);
+    else {
+      int bucket = 0;
+      while(bucket < 3 && !fitsSigned(dod, c_dodBits[bucket]))
+        bucket++;
+      static const int prefix[] = {0b10, 0b110, 0b1110, 0b1111};
+      d_bs.write(prefix[bucket], bucket == 3 ? 4 : bucket + 2);
+      int nbits = bucket < 3 ? c_dodBits[bucket] : 64;
+      d_bs.write(nbits < 64 ? (uint64_t)dod & ((uint64_t(1) << nbits) - 1) : (uint64_t)dod, nbits);
+    }
+    d_delta = delta;
+
+    uint64_t x = u ^ d_v;
+    if(!x)
+      d_bs.write(0, 1);
+    else {
+      int leading = std::min(__builtin_clzll(x), 31);
+      int trailing = __builtin_ctzll(x);
+      if(d_leading >= 0 && leading >= d_leading && trailing >= d_trailing) {
+        // fits in the previous window
+        d_bs.write(2, 2);
+        d_bs.write(x >> d_trailing, 64 - d_leading - d_trailing);
+      }
+      else {
+        int sigbits = 64 - leading - trailing;
+        d_bs.write(3, 2);
+        d_bs.write(leading, 5);
+        d_bs.write(sigbits & 63, 6); // 64 is stored as 0
+        d_bs.write(x >> trailing, sigbits);
+        d_leading = leading;
+        d_trailing = trailing;
+      }
+    }
+  }
+  d_t = t;
+  d_v = u;
+  d_count++;
+}
+
+bool XorChunk::Iterator::next()
+{
+  if(d_n == d_c.d_count)
+    return false;
+  const auto& bs = d_c.d_bs;
+  if(!d_n) {
+    d_t = bs.read(d_pos, 64);
+    d_v = bs.read(d_pos, 64);
+  }
+  else {
+    int bucket = 0;
+    while(bucket < 4 && bs.read(d_pos, 1))
+      bucket++;
+    if(bucket) {
+      int nbits = bucket < 4 ? c_dodBits[bucket - 1] : 64;
+      d_delta += signExtend(bs.read(d_pos, nbits), nbits);
+    }
+    d_t += d_delta;
+
+    if(bs.read(d_pos, 1)) {
+      if(bs.read(d_pos, 1)) {
+        d_leading = bs.read(d_pos, 5);
+        int sigbits = bs.read(d_pos, 6);
+        if(!sigbits)
+          sigbits = 64;
+        d_trailing = 64 - d_leading - sigbits;
+      }
+      int sigbits = 64 - d_leading - d_trailing;
+      d_v ^= bs.read(d_pos, sigbits) << d_trailing;
+    }
+  }
+  d_n++;
+  return true;
+}
+
+double XorChunk::Iterator::v() const
+{
+  double d;
+  memcpy(&d, &d_v, sizeof(d));
+  return d;
+}
+
+uint32_t PromHead::lookup(std::string_view name, const std::map<std::string, std::string>& labels) const
+{
+  auto range = d_index.equal_range(seriesFingerprint(name, labels));
+  for(auto iter = range.first; iter != range.second; ++iter) {
+    const auto& s = d_series[iter->second];
+    if(s.name == name && s.labels == labels)
+      return iter->second;
+  }
+  return npos;
+}
+
+uint32_t PromHead::getOrCreate(std::string_view name, const std::map<std::string, std::string>& labels)
+{
+  uint32_t id = lookup(name, labels);
+  if(id != npos)
+    return id;
+  if(!d_free.empty()) {
+    id = d_free.back();
+    d_free.pop_back();
+  }
+  else {
+    id = d_series.size();
+    d_series.emplace_back();
+  }
+  auto& s = d_series[id];
+  s.name = name;
+  s.labels = labels;
+  s.fingerprint = seriesFingerprint(name, labels);
+  d_index.emplace(s.fingerprint, id);
+  d_postings.add(id, s.name, s.labels);
+  return id;
+}
+
+size_t PromHead::append(std::string_view name, const std::map<std::string, std::string>& labels, int64_t t, double v)
+{
+  auto& s = d_series[getOrCreate(name, labels)];
+  if(!s.chunks.empty()) {
+    auto& last = s.chunks.back();
+    if(t <= last.maxTime())
+      return 0;
+    if(last.numSamples() >= d_opts.maxChunkSamples || t - last.minTime() >= d_opts.maxChunkRangeMsec)
+      s.chunks.emplace_back();
+  }
+  else
+    s.chunks.emplace_back();
+  s.chunks.back().append(t, v);
+  return 1;
+}
+
+size_t PromHead::append(const PromParser::promparseres_t& scrape, int64_t scrapeTime)
+{
+  size_t ret = 0;
+  for(const auto& [name, entry] : scrape)
+    for(const auto& [labels, tv] : entry.vals)
+      ret += append(name, labels, tv.tstampmsec ? tv.tstampmsec : scrapeTime, tv.value);
+  return ret;
+}
+
+size_t PromHead::ingest(const PromParser& pp, std::string_view in, int64_t scrapeTime)
+{
+  size_t ret = 0;
+  pp.parse(in, [&](const PromParser::PromSample& s) {
+    ret += append(s.name, s.labels, s.tstampmsec ? s.tstampmsec : scrapeTime, s.value);
+  });
+  return ret;
+}
+
+void PromHead::truncate(int64_t mint)
+{
+  vector<PostingsIndex::SeriesRef> removed;
+  for(uint32_t id = 0; id < d_series.size(); ++id) {
+    auto& s = d_series[id];
+    if(s.chunks.empty())
+      continue; // already free
+    auto keep = std::find_if(s.chunks.begin(), s.chunks.end(), [mint](const XorChunk& c) {
+      return c.maxTime() >= mint;
+    });
+    s.chunks.erase(s.chunks.begin(), keep);
+    if(!s.chunks.empty())
+      continue;
+
+    auto range = d_index.equal_range(s.fingerprint);
+    for(auto iter = range.first; iter != range.second; ++iter) {
+      if(iter->second == id) {
+        d_index.erase(iter);
+        break;
+      }
+    }
+    removed.push_back({id, s.name, &s.labels});
+  }
+  // all at once, removing series one by one rewrites the shared lists each time
+  d_postings.remove(removed);
+  for(const auto& r : removed) {
+    auto& s = d_series[r.id];
+    s.name.clear();
+    s.labels.clear();
+    d_free.push_back(r.id);
+  }
+}
+
+size_t PromHead::numSamples() const
+{
+  size_t ret = 0;
+  for(const auto& s : d_series)
+    for(const auto& c : s.chunks)
+      ret += c.numSamples();
+  return ret;
+}
+
+size_t PromHead::bytes() const
+{
+  size_t ret = 0;
+  for(const auto& s : d_series)
+    for(const auto& c : s.chunks)
+      ret += c.bytes();
+  return ret;
+}
+
+PromHead::RangeIterator::RangeIterator(const PromHead& head, uint32_t series, int64_t mint, int64_t maxt)
+  : d_chunks(head.d_series.at(series).chunks), d_mint(mint), d_maxt(maxt)
+{
+  // skip chunks that end before the range
+  while(d_chunk < d_chunks.size() && d_chunks[d_chunk].maxTime() < mint)
+    d_chunk++;
+}
+
+bool PromHead::RangeIterator::next()
+{
+  while(d_chunk < d_chunks.size()) {
+    if(!d_it) {
+      if(d_chunks[d_chunk].minTime() > d_maxt)
+        return false;
+      d_it.emplace(d_chunks[d_chunk]);
+    }
+    while(d_it->next()) {
+      if(d_it->t() > d_maxt)
+        return false;
+      if(d_it->t() >= d_mint)
+        return true;
+    }
+    d_it.reset();
+    d_chunk++;
+  }
+  return false;
+}
@@ -0,0 +1,128 @@
+#pragma once
+#include "promparser.hh"
+#include "postings.hh"
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// bits are written most significant first
+class BitStream
+{
+public:
+  void write(uint64_t v, int nbits);
+  uint64_t read(size_t& pos, int nbits) const;
+  size_t bytes() const { return d_bytes.size(); }
+private:
+  std::vector<uint8_t> d_bytes;
+  size_t d_bits = 0;
+};
+
+/* Gorilla compressed samples: timestamps as delta-of-delta in variable size
+   buckets, values XORed with their predecessor, storing only the meaningful
+   bits. A regular scrape interval costs 1 bit per timestamp, an unchanged
+   value 1 bit per value */
+class XorChunk
+{
+public:
+  void append(int64_t t, double v);
+  uint32_t numSamples() const { return d_count; }
+  int64_t minTime() const { return d_minTime; }
+  int64_t maxTime() const { return d_t; }
+  size_t bytes() const { return d_bs.bytes(); }
+
+  class Iterator
+  {
+  public:
+    explicit Iterator(const XorChunk& c) : d_c(c) {}
+    bool next(); // advances to the next sample, false at the end
+    int64_t t() const { return d_t; }
+    double v() const;
+  private:
+    const XorChunk& d_c;
+    size_t d_pos = 0;
+    uint32_t d_n = 0;
+    int64_t d_t = 0, d_delta = 0;
+    uint64_t d_v = 0;
+    int d_leading = 0, d_trailing = 0;
+  };
+
+private:
+  BitStream d_bs;
+  uint32_t d_count = 0;
+  int64_t d_minTime = 0, d_t = 0, d_delta = 0;
+  uint64_t d_v = 0;
+  int d_leading = -1, d_trailing = 0; // -1: no XOR window yet
+};
+
+/* A short in-memory history of scraped series, like the head block of a
+   TSDB. Series are found by fingerprint, each has a list of chunks of which
+   only the last one is appended to */
+class PromHead
+{
+public:
+  struct Options
+  {
+    uint32_t maxChunkSamples = 120;
+    int64_t maxChunkRangeMsec = 30 * 60 * 1000;
+    int64_t retentionMsec = 2 * 3600 * 1000;
+  };
+  static constexpr uint32_t npos = UINT32_MAX;
+
+  PromHead() : PromHead(Options()) {}
+  explicit PromHead(const Options& opts) : d_opts(opts) {}
+
+  // samples without timestamp get scrapeTime, returns how many were appended,
+  // samples that are not newer than the last one of their series are dropped
+  size_t append(const PromParser::promparseres_t& scrape, int64_t scrapeTime);
+  size_t append(std::string_view name, const std::map<std::string, std::string>& labels, int64_t t, double v);
+  // parses straight into the head, without building a promparseres_t
+  size_t ingest(const PromParser& pp, std::string_view in, int64_t scrapeTime);
+
+  // drops chunks that end before mint, and series left without chunks
+  void truncate(int64_t mint);
+  void applyRetention(int64_t now) { truncate(now - d_opts.retentionMsec); }
+
+  uint32_t lookup(std::string_view name, const std::map<std::string, std::string>& labels) const;
+  // sorted ids of the series matching a selector like {job="x", arch=~"amd.*"}
+  std::vector<uint32_t> select(const std::vector<LabelMatcher>& matchers) const { return d_postings.select(matchers); }
+  const std::string& name(uint32_t id) const { return d_series.at(id).name; }
+  const std::map<std::string, std::string>& labels(uint32_t id) const { return d_series.at(id).labels; }
+  size_t numSeries() const { return d_series.size() - d_free.size(); }
+  size_t numSamples() const;
+  size_t bytes() const; // compressed sample data only
+
+  // samples of one series with mint <= t <= maxt, in time order
+  class RangeIterator
+  {
+  public:
+    RangeIterator(const PromHead& head, uint32_t series, int64_t mint, int64_t maxt);
+    bool next();
+    int64_t t() const { return d_it->t(); }
+    double v() const { return d_it->v(); }
+  private:
+    const std::vector<XorChunk>& d_chunks;
+    int64_t d_mint, d_maxt;
+    size_t d_chunk = 0;
+    std::optional<XorChunk::Iterator> d_it;
+  };
+
+private:
+  struct Series
+  {
+    std::string name;
+    std::map<std::string, std::string> labels;
+    uint64_t fingerprint;
+    std::vector<XorChunk> chunks;
+  };
+  uint32_t getOrCreate(std::string_view name, const std::map<std::string, std::string>& labels);
+
+  Options d_opts;
+  std::vector<Series> d_series;
+  std::vector<uint32_t> d_free; // slots of removed series
+  std::unordered_multimap<uint64_t, uint32_t> d_index;
+  PostingsIndex d_postings;
+};
@@ -0,0 +1,71 @@
+#include "promparser.hh"
+#include "mappedfile.hh"
+#include <fmt/core.h>
+#include <chrono>
+#include <functional>
+#include <fstream>
+#include <sstream>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+using namespace std;
+
+// compares reading a file through ifstream/stringstream with MappedFile,
+// each run happens in a child process so peak RSS is measured in isolation
+// run as ./readbench big.txt
+
+static string readFileFrom(const char* fname)
+{
+  std::ifstream t(fname);
+  std::stringstream buffer;
+  buffer << t.rdbuf();
+  return buffer.str();
+}
+
+static void run(const char* name, const char* fname, const std::function<bool(const char*)>& fn)
+{
+  auto start = chrono::steady_clock::now();
+  pid_t pid = fork();
+  if(pid < 0)
+    throw runtime_error("fork failed");
+  if(!pid)
+    _exit(fn(fname) ? 0 : 1);
+
+  int status;
+  struct rusage ru;
+  if(wait4(pid, &status, 0, &ru) < 0)
+    throw runtime_error("wait4 failed");
+  auto msec = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+  fmt::print("{:<8} {:10.2f} ms {:10.1f} MB peak RSS{}\n", name, msec, ru.ru_maxrss / 1024.0,
+             WIFEXITED(status) && !WEXITSTATUS(status) ? "" : " (failed)");
+}
+
+int main(int argc, char** argv)
+{
+  if(argc != 2) {
+    fmt::print("Run as: ./readbench prometheus.txt\n");
+    return 0;
+  }
+  PromParser pp; // grammar compiled before forking, so it is not measured
+
+  fmt::print("read only:\n");
+  run("stream", argv[1], [](const char* fname) {
+    return !readFileFrom(fname).empty();
+  });
+  run("mmap", argv[1], [](const char* fname) {
+    MappedFile mf(fname);
+    unsigned int sum = 0; // touch every page, like the parser would
+    for(auto c : mf.view())
+      sum += c;
+    return sum > 0;
+  });
+
+  fmt::print("read and parse:\n");
+  run("stream", argv[1], [&](const char* fname) {
+    return !pp.parse(readFileFrom(fname)).empty();
+  });
+  run("mmap", argv[1], [&](const char* fname) {
+    MappedFile mf(fname);
+    return !pp.parse(mf.view()).empty();
+  });
+}
@@ -0,0 +1,221 @@
+#include "relabel.hh"
+#include <algorithm>
+#include <stdexcept>
+using namespace std;
+
+/* Splits a replacement into literal text and group references, following
+   Go's Regexp.Expand like Prometheus does: $name takes the longest run of
+   letters, digits and '_', so "$10" is group 10 and "${1}0" is group 1
+   followed by a 0. Names that are not numbers expand to nothing, std::regex
+   has no named groups. A '$' that starts no reference stays as it is */
+static std::vector<std::pair<std::string, int>> parseReplacement(const std::string& in)
+{
+  vector<pair<string, int>> ret(1, {string(), -1});
+  auto isName = [](char c) { return isalnum((unsigned char)c) || c == '_'; };
+  for(size_t pos = 0; pos < in.size(); ++pos) {
+    if(in[pos] != '$' || pos + 1 == in.size()) {
+      ret.back().first += in[pos];
+      continue;
+    }
+    if(in[pos + 1] == '$') {
+      ret.back().first += '$';
+      pos++;
+      continue;
+    }
+    string name;
+    size_t end;
+    if(in[pos + 1] == '{') {
+      end = in.find('}', pos);
+      if(end == string::npos)
+        throw runtime_error("Unterminated ${ in relabel replacement '" + in + "'");
+      name = in.substr(pos + 2, end - pos - 2);
+      if(name.empty() || !all_of(name.begin(), name.end(), isName)) {
+        ret.back().first += '$';
+        continue;
+      }
+    }
+    else {
+      for(end = pos + 1; end < in.size() && isName(in[end]); ++end)
+        ;
+      if(end == pos + 1) {
+        ret.back().first += '$';
+        continue;
+      }
+      name = in.substr(pos + 1, end - pos - 1);
+      end--;
+    }
+    int group = -2; // named, always empty
+    if(all_of(name.begin(), name.end(), [](char c) { return isdigit((unsigned char)c); }))
+      group = name.size() > 9 ? -2 : stoi(name);
+    if(group != -2) {
+      ret.back().second = group;
+      ret.push_back({string(), -1});
+    }
+    pos = end;
+  }
+  return ret;
+}
+
+std::string& RelabelScratch::next()
+{
+  if(d_used == d_strings.size())
+    d_strings.emplace_back();
+  auto& ret = d_strings[d_used++];
+  ret.clear(); // keeps the capacity
+  return ret;
+}
+
+std::string_view Relabeler::expand(const Compiled& r, const std::cmatch& m, RelabelScratch& scratch)
+{
+  auto& ret = scratch.next();
+  for(const auto& [text, group] : r.replacement) {
+    ret += text;
+    if(group >= 0 && (size_t)group < m.size())
+      ret.append(m[group].first, m[group].second);
+  }
+  return ret;
+}
+
+Relabeler::Relabeler(const std::vector<RelabelRule>& rules)
+{
+  using A = RelabelRule::Action;
+  for(const auto& r : rules) {
+    Compiled c{r.action, r.sourceLabels, r.separator, std::regex(r.regex, std::regex::optimize),
+               r.targetLabel, {}, r.modulus};
+    c.replacement = parseReplacement(r.replacement);
+    if((r.action == A::Replace || r.action == A::HashMod) && r.targetLabel.empty())
+      throw runtime_error("Relabel rule needs a target label");
+    if(r.action == A::HashMod && !r.modulus)
+      throw runtime_error("Relabel hashmod rule needs a modulus");
+    d_rules.push_back(std::move(c));
+  }
+}
+
+static bool labelNameLess(const pair<string_view, string_view>& a, string_view b)
+{
+  return a.first < b;
+}
+
+static bool getLabel(string_view name, const relabelviews_t& labels, string_view key, string_view& value)
+{
+  if(key == "__name__") {
+    value = name;
+    return true;
+  }
+  auto iter = lower_bound(labels.begin(), labels.end(), key, labelNameLess);
+  if(iter == labels.end() || iter->first != key)
+    return false;
+  value = iter->second;
+  return true;
+}
+
+// an empty value removes the label, as a missing label reads as ""
+static void setLabel(string_view& name, relabelviews_t& labels, string_view key, string_view value)
+{
+  if(key == "__name__") {
+    name = value;
+    return;
+  }
+  auto iter = lower_bound(labels.begin(), labels.end(), key, labelNameLess);
+  bool found = iter != labels.end() && iter->first == key;
+  if(value.empty()) {
+    if(found)
+      labels.erase(iter);
+  }
+  else if(found)
+    iter->second = value;
+  else
+    labels.emplace(iter, key, value);
+}
+
+static bool regexMatch(string_view s, const std::regex& re)
+{
+  return std::regex_match(s.data(), s.data() + s.size(), re);
+}
+
+static bool regexMatch(string_view s, std::cmatch& m, const std::regex& re)
+{
+  return std::regex_match(s.data(), s.data() + s.size(), m, re);
+}
+
+bool Relabeler::apply(std::string_view& name, relabelviews_t& labels, RelabelScratch& scratch) const
+{
+  using A = RelabelRule::Action;
+  scratch.reset();
+  auto& joined = scratch.d_joined;
+  auto& m = scratch.d_match;
+  for(const auto& r : d_rules) {
+    joined.clear();
+    for(size_t n = 0; n < r.sourceLabels.size(); ++n) {
+      if(n)
+        joined += r.separator;
+      if(string_view v; getLabel(name, labels, r.sourceLabels[n], v))
+        joined += v;
+    }
+    switch(r.action) {
+    case A::Replace:
+      if(regexMatch(joined, m, r.re))
+        setLabel(name, labels, r.targetLabel, expand(r, m, scratch));
+      break;
+    case A::Keep:
+      if(!regexMatch(joined, r.re))
+        return false;
+      break;
+    case A::Drop:
+      if(regexMatch(joined, r.re))
+        return false;
+      break;
+    case A::LabelDrop:
+    case A::LabelKeep:
+      labels.erase(remove_if(labels.begin(), labels.end(), [&](const auto& l) {
+        return regexMatch(l.first, r.re) == (r.action == A::LabelDrop);
+      }), labels.end());
+      break;
+    case A::LabelMap: {
+      // collect first, inserting while iterating could revisit new labels
+      auto& mapped = scratch.d_mapped;
+      mapped.clear();
+      for(const auto& [k, v] : labels)
+        if(regexMatch(k, m, r.re))
+          mapped.emplace_back(expand(r, m, scratch), v);
+      for(const auto& [k, v] : mapped)
+        setLabel(name, labels, k, v);
+      break;
+    }
+    case A::HashMod: {
+      uint64_t h = 14695981039346656037ULL;
+      for(unsigned char c : joined) {
+        h ^= c;
+        h *= 1099511628211ULL;
+      }
+      auto& shard = scratch.next();
+      shard = to_string(h % r.modulus); // fits the small string buffer
+      setLabel(name, labels, r.targetLabel, shard);
+      break;
+    }
+    }
+  }
+  return !name.empty();
+}
+
+bool Relabeler::apply(std::string& name, std::map<std::string, std::string>& labels) const
+{
+  thread_local RelabelScratch t_scratch;
+  thread_local relabelviews_t t_views;
+  t_views.assign(labels.begin(), labels.end());
+  string_view newName = name;
+  if(!apply(newName, t_views, t_scratch))
+    return false;
+  if(newName.data() != name.data() || newName.size() != name.size())
+    name.assign(newName);
+  // labels the rules left alone are still views of their map nodes
+  if(!std::equal(labels.begin(), labels.end(), t_views.begin(), t_views.end(), [](const auto& a, const auto& b) {
+       return a.first.data() == b.first.data() && a.second.data() == b.second.data() && a.second.size() == b.second.size();
+     })) {
+    std::map<std::string, std::string> rewritten;
+    for(const auto& [k, v] : t_views)
+      rewritten.emplace_hint(rewritten.end(), k, v);
+    labels.swap(rewritten);
+  }
+  return true;
+}
@@ -0,0 +1,75 @@
+#pragma once
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <regex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// one entry of a Prometheus metric_relabel_configs list
+struct RelabelRule
+{
+  enum class Action { Replace, Keep, Drop, LabelDrop, LabelKeep, LabelMap, HashMod };
+  Action action = Action::Replace;
+  std::vector<std::string> sourceLabels; // __name__ is the metric name
+  std::string separator = ";";
+  std::string regex = "(.*)";
+  std::string targetLabel;
+  std::string replacement = "$1";        // $1, ${1} and $$ as in Go's Regexp.Expand
+  uint64_t modulus = 0;                  // HashMod only
+};
+
+// label pairs sorted by name, without duplicate names
+typedef std::vector<std::pair<std::string_view, std::string_view>> relabelviews_t;
+
+// text the rules produce, reused from sample to sample. Views that apply()
+// leaves behind may point in here, until the next apply() with this scratch
+class RelabelScratch
+{
+public:
+  std::string& next(); // an empty string, that stays put until reset()
+  void reset() { d_used = 0; }
+
+private:
+  friend class Relabeler;
+  std::deque<std::string> d_strings;
+  size_t d_used = 0;
+  std::string d_joined;
+  std::cmatch d_match;
+  relabelviews_t d_mapped;
+};
+
+/* Applies a list of relabel rules to a sample. The regexes are compiled once,
+   anchored as in Prometheus. The rules work on views of the name and labels,
+   only text they produce gets stored, in a RelabelScratch. HashMod uses FNV-1a
+   instead of MD5, so its shard numbers differ from those Prometheus would
+   compute */
+class Relabeler
+{
+public:
+  Relabeler() = default;
+  explicit Relabeler(const std::vector<RelabelRule>& rules); // throws on invalid rules
+
+  // false if the sample is dropped, name and labels are then unspecified.
+  // Labels stay sorted, new values and names point into scratch
+  bool apply(std::string_view& name, relabelviews_t& labels, RelabelScratch& scratch) const;
+  // the same on owned strings, which are only rewritten if a rule changed them
+  bool apply(std::string& name, std::map<std::string, std::string>& labels) const;
+  bool empty() const { return d_rules.empty(); }
+
+private:
+  struct Compiled
+  {
+    RelabelRule::Action action;
+    std::vector<std::string> sourceLabels;
+    std::string separator;
+    std::regex re;
+    std::string targetLabel;
+    // literal text, and the group to insert after it, or -1
+    std::vector<std::pair<std::string, int>> replacement;
+    uint64_t modulus;
+  };
+  static std::string_view expand(const Compiled& r, const std::cmatch& m, RelabelScratch& scratch);
+  std::vector<Compiled> d_rules;
+};
@@ -0,0 +1,88 @@
+#include "scrapediff.hh"
+#include "fingerprint.hh"
+#include <algorithm>
+#include <cstring>
+using namespace std;
+
+// fingerprint first, the strings are only compared if two of those collide
+static bool entryLess(const CounterScrape::Entry& a, const CounterScrape::Entry& b)
+{
+  if(a.fingerprint != b.fingerprint)
+    return a.fingerprint < b.fingerprint;
+  if(*a.name != *b.name)
+    return *a.name < *b.name;
+  return *a.labels < *b.labels;
+}
+
+static bool isCounter(const PromParser::promparseres_t& res, const string& name, const PromParser::PromEntry& entry)
+{
+  if(entry.type == "counter")
+    return true;
+  if(!entry.type.empty())
+    return false;
+  // histogram and summary parts have no TYPE line of their own
+  for(const char* suffix : {"_bucket", "_sum", "_count"}) {
+    size_t len = strlen(suffix);
+    if(name.size() > len && !name.compare(name.size() - len, len, suffix)) {
+      auto iter = res.find(name.substr(0, name.size() - len));
+      return iter != res.end() && (iter->second.type == "histogram" || iter->second.type == "summary");
+    }
+  }
+  return false;
+}
+
+CounterScrape::CounterScrape(const PromParser::promparseres_t& res, int64_t scrapeTime)
+{
+  for(const auto& [name, entry] : res) {
+    if(!isCounter(res, name, entry))
+      continue;
+    for(const auto& [labels, tv] : entry.vals)
+      entries.push_back({seriesFingerprint(name, labels), tv.value,
+                         tv.tstampmsec ? tv.tstampmsec : scrapeTime, &name, &labels, false});
+  }
+  sort(entries.begin(), entries.end(), entryLess);
+  for(size_t n = 1; n < entries.size(); ++n) {
+    if(entries[n].fingerprint == entries[n-1].fingerprint)
+      entries[n].collides = entries[n-1].collides = true;
+  }
+}
+
+CounterDiff diffCounters(const CounterScrape& prev, const CounterScrape& cur)
+{
+  CounterDiff ret;
+  size_t expect = min(prev.entries.size(), cur.entries.size());
+  ret.rows.reserve(expect);
+  ret.deltas.reserve(expect);
+  ret.rates.reserve(expect);
+  ret.resets.reserve(expect);
+
+  auto p = prev.entries.begin();
+  for(uint32_t row = 0; row < cur.entries.size(); ++row) {
+    const auto& c = cur.entries[row];
+    while(p != prev.entries.end() && p->fingerprint < c.fingerprint)
+      ++p;
+    if(p == prev.entries.end())
+      break;
+    if(p->fingerprint != c.fingerprint)
+      continue; // new series
+    if(c.collides || p->collides) {
+      // several series share this fingerprint, only here do names and labels get compared
+      auto q = p;
+      while(q != prev.entries.end() && q->fingerprint == c.fingerprint && entryLess(*q, c))
+        ++q;
+      if(q == prev.entries.end() || q->fingerprint != c.fingerprint || entryLess(c, *q))
+        continue;
+      p = q;
+    }
+
+    bool reset = c.value < p->value;
+    double delta = reset ? c.value : c.value - p->value;
+    int64_t msec = c.tstampmsec - p->tstampmsec;
+    ret.rows.push_back(row);
+    ret.deltas.push_back(delta);
+    ret.rates.push_back(msec > 0 ? delta * 1000.0 / msec : 0);
+    ret.resets.push_back(reset);
+    ++p;
+  }
+  return ret;
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include "promparser.hh"
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+/* The counters of one scrape, sorted by series fingerprint, so two
+   consecutive scrapes can be aligned in a single merge pass. Counters are
+   series of families with '# TYPE counter', plus the _bucket, _sum and _count
+   series of histograms and summaries.
+
+   Series are matched on their 64-bit fingerprint alone, names and labels are
+   only compared for fingerprints that occur more than once within a scrape.
+   Two different series that each have a unique fingerprint in their own
+   scrape but share it across the two would be paired, the odds of that are
+   about n^2/2^65 for n series.
+
+   Entries point into the parse result, which must outlive this object. */
+class CounterScrape
+{
+public:
+  // samples without timestamp get scrapeTime
+  CounterScrape(const PromParser::promparseres_t& res, int64_t scrapeTime);
+
+  struct Entry
+  {
+    uint64_t fingerprint;
+    double value;
+    int64_t tstampmsec;
+    const std::string* name;
+    const std::map<std::string, std::string>* labels;
+    bool collides; // another entry in this scrape has the same fingerprint
+  };
+  std::vector<Entry> entries;
+};
+
+// one row per counter present in both scrapes, in fingerprint order
+struct CounterDiff
+{
+  std::vector<uint32_t> rows; // index into the entries of the current scrape
+  std::vector<double> deltas;
+  std::vector<double> rates;  // per second
+  std::vector<uint8_t> resets; // 1 if the counter went down, delta is then the new value
+};
+
+CounterDiff diffCounters(const CounterScrape& prev, const CounterScrape& cur);
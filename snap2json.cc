@@ -0,0 +1,38 @@
+#include "promsnap.hh"
+#include "promjson.hh"
+#include <fmt/core.h>
+
+using namespace std;
+
+// prints the same document prom2json would have printed for the original text
+int main(int argc, char** argv)
+{
+  if(argc != 2) {
+    fmt::print("Run as: ./snap2json prometheus.snap\n");
+    return 0;
+  }
+  PromSnapView sv(argv[1]);
+  BufferedWriter out(1);
+  JsonWriter jw(out, 1);
+
+  if(!sv.numFamilies())
+    jw.null();
+  else {
+    jw.startObject();
+    for(uint32_t f = 0; f < sv.numFamilies(); ++f) {
+      const auto& fam = sv.family(f);
+      writeJsonFamilyStart(jw, sv.str(fam.name), sv.str(fam.help), sv.str(fam.type));
+      for(uint32_t s = fam.firstSeries; s < fam.firstSeries + fam.seriesCount; ++s)
+        writeJsonSample(jw, [&] {
+          for(auto l = sv.labelsBegin(s); l != sv.labelsEnd(s); ++l) {
+            jw.key(sv.str(l->name));
+            jw.value(sv.str(l->value));
+          }
+        }, sv.timestamp(s), sv.value(s));
+      writeJsonFamilyEnd(jw);
+    }
+    jw.endObject();
+  }
+  out.append('\n');
+  out.flush();
+}
@@ -0,0 +1,65 @@
+#include "promparser.hh"
+#include "promsnap.hh"
+#include "mappedfile.hh"
+#include <fmt/core.h>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <unistd.h>
+using namespace std;
+
+// compares getting at all values of a scrape by reparsing its text, by
+// opening a snapshot of it, and by turning that snapshot back into maps
+// run as ./snapbench prometheus.txt [runs]
+
+template<typename F>
+static void measure(const char* name, int runs, F f)
+{
+  double sum = 0;
+  auto start = chrono::steady_clock::now();
+  for(int n = 0; n < runs; ++n)
+    sum += f();
+  double usec = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count() / runs;
+  fmt::print("{:<16} {:12.1f} us/load (checksum {})\n", name, usec, sum);
+}
+
+int main(int argc, char** argv)
+{
+  if(argc < 2) {
+    fmt::print("Run as: ./snapbench prometheus.txt [runs]\n");
+    return 0;
+  }
+  int runs = argc > 2 ? atoi(argv[2]) : 10;
+  PromParser pp;
+  MappedFile mf(argv[1]);
+  auto snap = makePromSnapshot(pp.parse(mf.view()));
+  string fname = fmt::format("/tmp/snapbench.{}.snap", getpid());
+  FILE* fp = fopen(fname.c_str(), "w");
+  if(!fp || fwrite(snap.data(), 1, snap.size(), fp) != snap.size() || fclose(fp))
+    throw runtime_error("Unable to write "+fname);
+  fmt::print("text {} bytes, snapshot {} bytes\n", mf.view().size(), snap.size());
+
+  measure("reparse text", runs, [&]() {
+    double sum = 0;
+    for(const auto& f : pp.parse(mf.view()))
+      for(const auto& v : f.second.vals)
+        sum += isfinite(v.second.value) ? v.second.value : 0;
+    return sum;
+  });
+  measure("snapshot view", runs, [&]() {
+    PromSnapView sv(fname);
+    double sum = 0;
+    for(uint32_t s = 0; s < sv.numSeries(); ++s)
+      sum += isfinite(sv.value(s)) ? sv.value(s) : 0;
+    return sum;
+  });
+  measure("snapshot to map", runs, [&]() {
+    PromSnapView sv(fname);
+    double sum = 0;
+    for(const auto& f : sv.toParseResult())
+      for(const auto& v : f.second.vals)
+        sum += isfinite(v.second.value) ? v.second.value : 0;
+    return sum;
+  });
+  unlink(fname.c_str());
+}
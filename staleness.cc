@@ -0,0 +1,79 @@
+#include "staleness.hh"
+#include "fingerprint.hh"
+using namespace std;
+
+SeriesRegistry::SeriesRegistry(fingerprint_t fingerprint) :
+  d_fingerprint(fingerprint ? fingerprint : seriesFingerprint)
+{}
+
+void SeriesRegistry::unlink(uint32_t idx)
+{
+  auto& e = d_entries[idx];
+  (e.prev == npos ? d_head : d_entries[e.prev].next) = e.next;
+  (e.next == npos ? d_tail : d_entries[e.next].prev) = e.prev;
+}
+
+void SeriesRegistry::pushFront(uint32_t idx)
+{
+  auto& e = d_entries[idx];
+  e.prev = npos;
+  e.next = d_head;
+  (d_head == npos ? d_tail : d_entries[d_head].prev) = idx;
+  d_head = idx;
+}
+
+bool SeriesRegistry::see(std::string_view name, const std::map<std::string, std::string>& labels)
+{
+  uint64_t fp = d_fingerprint(name, labels);
+  auto range = d_index.equal_range(fp);
+  for(auto iter = range.first; iter != range.second; ++iter) {
+    auto& e = d_entries[iter->second];
+    if(e.series.name == name && e.series.labels == labels) {
+      e.generation = d_generation;
+      if(d_head != iter->second) {
+        unlink(iter->second);
+        pushFront(iter->second);
+      }
+      return false;
+    }
+  }
+
+  uint32_t idx;
+  if(!d_free.empty()) {
+    idx = d_free.back();
+    d_free.pop_back();
+  }
+  else {
+    idx = d_entries.size();
+    d_entries.emplace_back();
+  }
+  auto& e = d_entries[idx];
+  e.series.name = name;
+  e.series.labels = labels;
+  e.fingerprint = fp;
+  e.generation = d_generation;
+  d_index.emplace(fp, idx);
+  pushFront(idx);
+  return true;
+}
+
+std::vector<SeriesRegistry::Series> SeriesRegistry::endScrape()
+{
+  vector<Series> ret;
+  while(d_tail != npos && d_entries[d_tail].generation != d_generation) {
+    uint32_t idx = d_tail;
+    auto& e = d_entries[idx];
+    unlink(idx);
+    auto range = d_index.equal_range(e.fingerprint);
+    for(auto iter = range.first; iter != range.second; ++iter) {
+      if(iter->second == idx) {
+        d_index.erase(iter);
+        break;
+      }
+    }
+    ret.push_back(std::move(e.series));
+    e.series = Series();
+    d_free.push_back(idx);
+  }
+  return ret;
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// the NaN Prometheus writes to mark a series as gone, distinct from a NaN sample
+inline constexpr uint64_t c_staleNaNBits = 0x7ff0000000000002ULL;
+
+inline double staleNaN()
+{
+  double d;
+  memcpy(&d, &c_staleNaNBits, sizeof(d));
+  return d;
+}
+
+inline bool isStaleNaN(double d)
+{
+  uint64_t bits;
+  memcpy(&bits, &d, sizeof(bits));
+  return bits == c_staleNaNBits;
+}
+
+/* The series of one target across scrapes. Every series seen in a scrape is
+   stamped with the scrape's generation and moved to the front of a list, so
+   at the end those not seen are all at the back. Finding them costs the
+   number of disappeared series, not the number of series */
+class SeriesRegistry
+{
+public:
+  struct Series
+  {
+    std::string name;
+    std::map<std::string, std::string> labels;
+  };
+
+  typedef uint64_t (*fingerprint_t)(std::string_view, const std::map<std::string, std::string>&);
+  // fingerprint is seriesFingerprint() unless a test wants collisions
+  explicit SeriesRegistry(fingerprint_t fingerprint = nullptr);
+
+  void beginScrape() { d_generation++; }
+  // true if the series was not there in the previous scrape
+  bool see(std::string_view name, const std::map<std::string, std::string>& labels);
+  // the series not seen since beginScrape(), which are then forgotten
+  std::vector<Series> endScrape();
+
+  size_t size() const { return d_index.size(); }
+  uint64_t generation() const { return d_generation; }
+
+private:
+  static constexpr uint32_t npos = UINT32_MAX;
+  struct Entry
+  {
+    Series series;
+    uint64_t fingerprint;
+    uint64_t generation;
+    uint32_t prev;
+    uint32_t next;
+  };
+  void unlink(uint32_t idx);
+  void pushFront(uint32_t idx);
+
+  std::vector<Entry> d_entries;
+  std::vector<uint32_t> d_free;
+  fingerprint_t d_fingerprint;
+  std::unordered_multimap<uint64_t, uint32_t> d_index; // colliding series share a fingerprint
+  uint32_t d_head = npos;
+  uint32_t d_tail = npos;
+  uint64_t d_generation = 0;
+};
@@ -0,0 +1,47 @@
+#include "promtsdb.hh"
+#include <fmt/core.h>
+#include <chrono>
+#include <random>
+using namespace std;
+
+// appends synthetic scrapes to a PromHead and reports throughput and size
+// run as ./tsdbbench [series] [scrapes]
+
+int main(int argc, char** argv)
+{
+  size_t nseries = argc > 1 ? atoi(argv[1]) : 10000;
+  size_t nscrapes = argc > 2 ? atoi(argv[2]) : 240; // an hour at 15s
+
+  // a mix of counters, gauges and constant values, as real exporters have
+  mt19937_64 rng(42);
+  PromParser::promparseres_t scrape;
+  for(size_t n = 0; n < nseries; ++n) {
+    auto& entry = scrape[fmt::format("metric_{}", n % 100)];
+    entry.vals[{{"instance", fmt::format("host{}:9100", n / 100)}, {"job", "node"}}] = {0, double(rng() % 1000)};
+  }
+
+  PromHead head;
+  size_t appended = 0;
+  int64_t t = 1713712554000;
+  double secs = 0;
+  for(size_t s = 0; s < nscrapes; ++s) {
+    t += 15000 + (rng() % 7 == 0 ? int64_t(rng() % 20) - 10 : 0); // occasional jitter
+    size_t n = 0;
+    for(auto& f : scrape) {
+      for(auto& v : f.second.vals) {
+        switch(n++ % 3) {
+        case 0: v.second.value += rng() % 5000; break;
+        case 1: v.second.value = (rng() % 100000) / 100.0; break;
+        default: break;
+        }
+      }
+    }
+    auto start = chrono::steady_clock::now();
+    appended += head.append(scrape, t);
+    secs += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  }
+  fmt::print("{} series, {} samples appended in {:.3f} s: {:.0f} samples/s\n",
+             head.numSeries(), appended, secs, appended / secs);
+  fmt::print("{} bytes of chunk data, {:.2f} bytes/sample (vs {} uncompressed)\n",
+             head.bytes(), double(head.bytes()) / head.numSamples(), sizeof(PromParser::TstampedValue));
+}